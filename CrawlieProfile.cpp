@@ -0,0 +1,83 @@
+
+
+#include "CrawlieProfile.h"
+
+void UCrawlieProfile::PostInitProperties()
+{
+	Super::PostInitProperties();
+	BuildProbeTable();
+}
+
+void UCrawlieProfile::PostLoad()
+{
+	Super::PostLoad();
+	BuildProbeTable();
+}
+
+#if WITH_EDITOR
+void UCrawlieProfile::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+	BuildProbeTable();
+}
+#endif
+
+void UCrawlieProfile::BuildProbeTable()
+{
+	const float R = ColliderRadius;
+	FCrawlieProbeTable& Table = ProbeTable;
+
+	Table.ColliderRadius = R;
+	Table.AheadWidth = AheadWidth * R;
+	Table.EdgeWidth = EdgeProbeSpread * 2;
+	Table.FloorProbeOffset = FloorProbeOffset * R;
+	Table.FloorProbeReach = Table.FloorProbeOffset + FloorProbeLength * R;
+	Table.TransitionSpeed = TransitionSpeed;
+	Table.FloorProbeMode = FloorProbeMode;
+
+	Table.Barrier = FCrawlieProbe(FVector3f::ZeroVector, FVector3f(BarrierDistance * R, 0, 0));
+
+	// Three heights across the front of the collider: low so we don't kick a toe, center, and high so
+	// we don't bump our head. A pair at each so the angle of the obstacle can be read off the distances.
+	const float Heights[FCrawlieProbeTable::NumTiers] = { -AheadHeight * R / 2, 0, AheadHeight * R / 2 };
+	const float Sides[FCrawlieProbeTable::NumSides] = { Table.AheadWidth / 2, -Table.AheadWidth / 2 };
+	for (int32 Tier = 0; Tier < FCrawlieProbeTable::NumTiers; ++Tier)
+	{
+		for (int32 Side = 0; Side < FCrawlieProbeTable::NumSides; ++Side)
+		{
+			Table.Ahead[Tier][Side] = FCrawlieProbe(
+				FVector3f(AheadOffset * R, Sides[Side], Heights[Tier]),
+				FVector3f(AheadLength * R, 0, 0));
+		}
+	}
+
+	const FVector3f FloorDelta(0, 0, -FloorProbeLength * R);
+	Table.FloorCenter = FCrawlieProbe(FVector3f(0, 0, -Table.FloorProbeOffset), FloorDelta);
+
+	// Substeps cover the front half of the collider, center to leading edge.
+	const int32 Steps = FMath::Max(FloorSubsteps, 2);
+	Table.FloorSubsteps.Reset(Steps);
+	for (int32 i = 0; i < Steps; ++i)
+	{
+		Table.FloorSubsteps.Emplace(FVector3f(R * i / (Steps - 1), 0, -Table.FloorProbeOffset), FloorDelta);
+	}
+
+	// Down and back from the bottom of the collider, to catch the face below an edge we walked off.
+	Table.Lower = FCrawlieProbe(FVector3f(0, 0, -R), FVector3f(-2 * R, 0, -R));
+	Table.LowerEdge[FCrawlieProbeTable::Right] = FCrawlieProbe(Table.Lower.Start + FVector3f(0, EdgeProbeSpread, 0), Table.Lower.Delta);
+	Table.LowerEdge[FCrawlieProbeTable::Left] = FCrawlieProbe(Table.Lower.Start - FVector3f(0, EdgeProbeSpread, 0), Table.Lower.Delta);
+
+	// Up and back from just under the collider, to catch the underside of a plank.
+	Table.Flipside = FCrawlieProbe(FVector3f(0, 0, -1.2f * R), FVector3f(-R, 0, R));
+
+	// From under the leading edge of the collider back to the surface plane two radii behind. The face
+	// below an edge is hit from the front, a plank from below.
+	Table.Classify = FCrawlieProbe(FVector3f(R, 0, -R - ClassifyDepth * R), FVector3f(-3 * R, 0, ClassifyDepth * R));
+
+	// Straight down under the leading edge, from the top of the floor window to where the classify
+	// probe starts. Floor in the window goes on, floor below it is a step down, and a miss means the
+	// classify probe doesn't start inside anything.
+	Table.FloorAhead = FCrawlieProbe(
+		FVector3f(R, 0, -Table.FloorProbeOffset),
+		FVector3f(0, 0, Table.Classify.Start.Z + Table.FloorProbeOffset));
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "CrawlieProfile.generated.h"
+
+// How a crawler looks for floor once the probe under its center misses.
+UENUM()
+enum class ECrawlieFloorProbeMode : uint8
+{
+	// A ray straight down under the leading edge for floor that goes on or steps down, and if that
+	// misses, one ray rising backwards under the crawler. The face it hits says whether the floor drops
+	// away over an edge or is a plank to wrap around. At most three queries with the one under the
+	// center, against ten or eleven for Substeps, but it can decide differently on ragged edges, so
+	// it is opt-in.
+	Classify,
+	// Substeps under the front half, then separate rays for lower ground and the flipside. The default.
+	Substeps,
+};
+
+// A ray in crawler-local space: X forward, Y right, Z up.
+struct FCrawlieProbe
+{
+	FVector3f Start = FVector3f::ZeroVector;
+	FVector3f Delta = FVector3f::ZeroVector;
+
+	FCrawlieProbe() = default;
+	FCrawlieProbe(const FVector3f& InStart, const FVector3f& InDelta)
+		: Start(InStart)
+		, Delta(InDelta)
+	{
+	}
+
+	void ToWorld(const FTransform& Frame, FVector& OutStart, FVector& OutEnd) const
+	{
+		OutStart = Frame.TransformPositionNoScale(FVector(Start));
+		OutEnd = OutStart + Frame.TransformVectorNoScale(FVector(Delta));
+	}
+};
+
+// Every probe a crawler casts, worked out once from a profile.
+struct FCrawlieProbeTable
+{
+	enum ETier { Low, Mid, High, NumTiers };
+	enum ESide { Right, Left, NumSides };
+
+	FCrawlieProbe Barrier;
+	FCrawlieProbe Ahead[NumTiers][NumSides];
+	FCrawlieProbe FloorCenter;
+	TArray<FCrawlieProbe, TInlineAllocator<8>> FloorSubsteps;
+	FCrawlieProbe Lower;
+	FCrawlieProbe LowerEdge[NumSides];
+	FCrawlieProbe Flipside;
+	FCrawlieProbe FloorAhead;
+	FCrawlieProbe Classify;
+	ECrawlieFloorProbeMode FloorProbeMode = ECrawlieFloorProbeMode::Substeps;
+
+	float ColliderRadius = 0;
+	float AheadWidth = 0;
+	float EdgeWidth = 0;
+	float FloorProbeOffset = 0;
+	// Depth of the bottom of the floor window, where the floor probes end.
+	float FloorProbeReach = 0;
+	float TransitionSpeed = 0;
+};
+
+// Tuning for one crawler species. Lengths are in collider radii unless noted.
+UCLASS(BlueprintType)
+class PHY_API UCrawlieProfile : public UPrimaryDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, Category = "Crawlie", meta = (ClampMin = "0.1", Units = "cm"))
+	float ColliderRadius = 10;
+	UPROPERTY(EditAnywhere, Category = "Crawlie", meta = (ClampMin = "0", ClampMax = "100", Units = "CentimetersPerSecond"))
+	float ForwardSpeed = 50;
+	// Fraction of ForwardSpeed used to move between surfaces.
+	UPROPERTY(EditAnywhere, Category = "Crawlie", meta = (ClampMin = "0.01"))
+	float TransitionSpeed = 0.3f;
+
+	UPROPERTY(EditAnywhere, Category = "Probes")
+	float BarrierDistance = 3;
+	UPROPERTY(EditAnywhere, Category = "Probes")
+	float AheadOffset = 0.5f;
+	UPROPERTY(EditAnywhere, Category = "Probes")
+	float AheadLength = 1.5f;
+	UPROPERTY(EditAnywhere, Category = "Probes")
+	float AheadWidth = 1.0f;
+	UPROPERTY(EditAnywhere, Category = "Probes")
+	float AheadHeight = 1.6f;
+	UPROPERTY(EditAnywhere, Category = "Probes")
+	ECrawlieFloorProbeMode FloorProbeMode = ECrawlieFloorProbeMode::Substeps;
+	UPROPERTY(EditAnywhere, Category = "Probes")
+	float FloorProbeOffset = 0.9f;
+	UPROPERTY(EditAnywhere, Category = "Probes")
+	float FloorProbeLength = 0.2f;
+	UPROPERTY(EditAnywhere, Category = "Probes", meta = (ClampMin = "2", EditCondition = "FloorProbeMode == ECrawlieFloorProbeMode::Substeps"))
+	int32 FloorSubsteps = 6;
+	// How far below the surface the classify probe starts. Drops shallower than this are stepped down
+	// onto directly, and geometry thinner than about two thirds of it is wrapped around as a plank.
+	UPROPERTY(EditAnywhere, Category = "Probes", meta = (ClampMin = "0.05", EditCondition = "FloorProbeMode == ECrawlieFloorProbeMode::Classify"))
+	float ClassifyDepth = 0.6f;
+	// Sideways offset of the two probes that measure the angle of an edge, in cm.
+	UPROPERTY(EditAnywhere, Category = "Probes", meta = (Units = "cm"))
+	float EdgeProbeSpread = 0.2f;
+
+	const FCrawlieProbeTable& GetProbeTable() const { return ProbeTable; }
+
+	virtual void PostInitProperties() override;
+	virtual void PostLoad() override;
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
+private:
+	void BuildProbeTable();
+
+	FCrawlieProbeTable ProbeTable;
+};
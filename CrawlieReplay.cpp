@@ -0,0 +1,283 @@
+
+
+#include "CrawlieReplay.h"
+#include "PhyCrawlie.h"
+#include "CrawlieStats.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace CrawlieReplay
+{
+	constexpr uint32 Magic = 0x4C505243; // "CRPL"
+	constexpr uint32 Version = 5;
+
+	// Bytes each record takes on disk, used to reject counts a file cannot hold before allocating for them.
+	constexpr int64 PoseBytes = sizeof(FVector) + sizeof(FQuat4f);
+	constexpr int64 HitBytes = 4 * sizeof(FVector3f) + sizeof(float) + sizeof(uint8);
+	constexpr int64 MinFrameBytes = sizeof(FQuat4f) + sizeof(FVector) + 5 * sizeof(float) + sizeof(int16) + sizeof(uint8)
+		+ 2 * PoseBytes + sizeof(float) + sizeof(int32) + sizeof(float) + sizeof(uint16);
+
+	static void SerializePose(FArchive& Ar, FCrawliePose& Pose)
+	{
+		Ar << Pose.Location << Pose.Rotation;
+	}
+
+	static void SerializeState(FArchive& Ar, FCrawlieReplayState& State)
+	{
+		FCrawlieHotState& Hot = State.Hot;
+		uint8 Flags = uint8(Hot.Flags);
+		Ar << Hot.Basis << Hot.Origin << Hot.U << Hot.V << Hot.Heading;
+		Ar << Hot.TimeUntilTurnRateChange << Hot.ForwardSpeed << Hot.TurnRateInDegrees << Flags;
+		Hot.Flags = ECrawlieFlags(Flags);
+		SerializePose(Ar, State.Transition.From);
+		SerializePose(Ar, State.Transition.To);
+		Ar << State.Transition.LerpValue << State.RandomSeed;
+	}
+
+	static void SerializeHit(FArchive& Ar, FCrawlieRecordedHit& Hit)
+	{
+		uint8 bBlockingHit = Hit.bBlockingHit;
+		Ar << Hit.Location << Hit.ImpactPoint << Hit.Normal << Hit.ImpactNormal << Hit.Distance << bBlockingHit;
+		Hit.bBlockingHit = bBlockingHit != 0;
+	}
+
+	static void SerializeFrame(FArchive& Ar, FCrawlieReplayFrame& Frame)
+	{
+		SerializeState(Ar, Frame.State);
+		Ar << Frame.DeltaTime;
+		uint16 NumHits = uint16(Frame.Hits.Num());
+		Ar << NumHits;
+		if (Ar.IsLoading())
+		{
+			if (NumHits > (Ar.TotalSize() - Ar.Tell()) / HitBytes)
+			{
+				Ar.SetError();
+				return;
+			}
+			Frame.Hits.SetNum(NumHits);
+		}
+		for (FCrawlieRecordedHit& Hit : Frame.Hits)
+		{
+			SerializeHit(Ar, Hit);
+		}
+	}
+
+	static void SaveAll(UWorld* World)
+	{
+		int32 NumSaved = 0;
+		for (TActorIterator<APhyCrawlie> It(World); It; ++It)
+		{
+			NumSaved += It->SaveReplay() ? 1 : 0;
+		}
+		UE_LOG(LogCrawlie, Display, TEXT("Saved %d crawler replays to %s"), NumSaved, *(FPaths::ProjectSavedDir() / TEXT("Crawlie/Replays")));
+	}
+}
+
+static TAutoConsoleVariable<int32> CVarCrawlieReplayRecord(
+	TEXT("crawlie.Replay.Record"),
+	0,
+	TEXT("Record every crawler that begins play from now on."));
+
+static TAutoConsoleVariable<int32> CVarCrawlieReplayFrames(
+	TEXT("crawlie.Replay.Frames"),
+	600,
+	TEXT("Frames kept in each crawler's replay ring."));
+
+static FAutoConsoleCommandWithWorld CrawlieReplaySaveCommand(
+	TEXT("crawlie.Replay.Save"),
+	TEXT("Write the replay ring of every recording crawler to Saved/Crawlie/Replays."),
+	FConsoleCommandWithWorldDelegate::CreateStatic(&CrawlieReplay::SaveAll));
+
+FCrawlieRecordedHit::FCrawlieRecordedHit(const FHitResult& Hit)
+	: Location(Hit.Location)
+	, ImpactPoint(Hit.ImpactPoint)
+	, Normal(Hit.Normal)
+	, ImpactNormal(Hit.ImpactNormal)
+	, Distance(Hit.Distance)
+	, bBlockingHit(Hit.bBlockingHit)
+{
+}
+
+void FCrawlieRecordedHit::ToHitResult(FHitResult& OutHit) const
+{
+	OutHit = FHitResult();
+	OutHit.Location = FVector(Location);
+	OutHit.ImpactPoint = FVector(ImpactPoint);
+	OutHit.Normal = FVector(Normal);
+	OutHit.ImpactNormal = FVector(ImpactNormal);
+	OutHit.Distance = Distance;
+	OutHit.bBlockingHit = bBlockingHit;
+}
+
+bool FCrawlieReplayState::Matches(const FCrawlieReplayState& Other) const
+{
+	return Hot.Flags == Other.Hot.Flags &&
+		Hot.TurnRateInDegrees == Other.Hot.TurnRateInDegrees &&
+		RandomSeed == Other.RandomSeed &&
+		Hot.GetLocation().Equals(Other.Hot.GetLocation(), 0.01f) &&
+		Hot.GetRotation().Equals(Other.Hot.GetRotation(), 1.e-4f) &&
+		Transition.From.GetLocation().Equals(Other.Transition.From.GetLocation(), 0.01f) &&
+		Transition.From.GetRotation().Equals(Other.Transition.From.GetRotation(), 1.e-4f) &&
+		Transition.To.GetLocation().Equals(Other.Transition.To.GetLocation(), 0.01f) &&
+		Transition.To.GetRotation().Equals(Other.Transition.To.GetRotation(), 1.e-4f) &&
+		FMath::IsNearlyEqual(Transition.LerpValue, Other.Transition.LerpValue) &&
+		FMath::IsNearlyEqual(Hot.TimeUntilTurnRateChange, Other.Hot.TimeUntilTurnRateChange) &&
+		FMath::IsNearlyEqual(Hot.ForwardSpeed, Other.Hot.ForwardSpeed);
+}
+
+FString FCrawlieReplay::GetDefaultPath(const APhyCrawlie& Crawler)
+{
+	return FPaths::ProjectSavedDir() / TEXT("Crawlie/Replays") / (Crawler.GetName() + TEXT(".crpl"));
+}
+
+bool FCrawlieReplay::Load(const FString& Path)
+{
+	TArray<uint8> Bytes;
+	if (!FFileHelper::LoadFileToArray(Bytes, *Path))
+	{
+		return false;
+	}
+
+	FMemoryReader Ar(Bytes);
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	int32 NumFrames = 0;
+	Ar << Magic << Version;
+	if (Magic != CrawlieReplay::Magic || Version != CrawlieReplay::Version)
+	{
+		UE_LOG(LogCrawlie, Error, TEXT("%s is not a version %u crawler replay"), *Path, CrawlieReplay::Version);
+		return false;
+	}
+
+	FString ProfilePath;
+	Ar << ProfilePath << NumFrames;
+	if (Ar.IsError() || NumFrames < 0 || NumFrames > (Ar.TotalSize() - Ar.Tell()) / CrawlieReplay::MinFrameBytes)
+	{
+		UE_LOG(LogCrawlie, Error, TEXT("%s is truncated or corrupt"), *Path);
+		return false;
+	}
+
+	Profile = FSoftObjectPath(ProfilePath);
+	Frames.SetNum(NumFrames);
+	for (FCrawlieReplayFrame& Frame : Frames)
+	{
+		CrawlieReplay::SerializeFrame(Ar, Frame);
+		if (Ar.IsError())
+		{
+			UE_LOG(LogCrawlie, Error, TEXT("%s is truncated or corrupt"), *Path);
+			Frames.Reset();
+			return false;
+		}
+	}
+	return true;
+}
+
+FCrawlieReplayRecorder::FCrawlieReplayRecorder(int32 InCapacity)
+	: Capacity(FMath::Max(InCapacity, 1))
+{
+	Frames.Reserve(Capacity);
+}
+
+TUniquePtr<FCrawlieReplayRecorder> FCrawlieReplayRecorder::CreateIfEnabled(bool bForce)
+{
+	if (!bForce && CVarCrawlieReplayRecord.GetValueOnGameThread() == 0)
+	{
+		return nullptr;
+	}
+	return MakeUnique<FCrawlieReplayRecorder>(CVarCrawlieReplayFrames.GetValueOnGameThread());
+}
+
+void FCrawlieReplayRecorder::BeginFrame(const FCrawlieReplayState& State, float DeltaTime)
+{
+	Current = Head;
+	Head = (Head + 1) % Capacity;
+
+	// Reuse the oldest frame once the ring is full, keeping its hit allocation.
+	FCrawlieReplayFrame& Frame = Frames.IsValidIndex(Current) ? Frames[Current] : Frames.AddDefaulted_GetRef();
+	Frame.State = State;
+	Frame.DeltaTime = DeltaTime;
+	Frame.Hits.Reset();
+}
+
+void FCrawlieReplayRecorder::RecordHit(const FHitResult& Hit)
+{
+	if (Current != INDEX_NONE)
+	{
+		Frames[Current].Hits.Emplace(Hit);
+	}
+}
+
+bool FCrawlieReplayRecorder::Save(const FString& Path, const UCrawlieProfile* Profile)
+{
+	TArray<uint8> Bytes;
+	FMemoryWriter Ar(Bytes);
+	uint32 Magic = CrawlieReplay::Magic;
+	uint32 Version = CrawlieReplay::Version;
+	FString ProfilePath = Profile ? FSoftObjectPath(Profile).ToString() : FString();
+	int32 NumFrames = Frames.Num();
+	Ar << Magic << Version << ProfilePath << NumFrames;
+
+	const int32 Oldest = Frames.Num() < Capacity ? 0 : Head;
+	for (int32 i = 0; i < NumFrames; ++i)
+	{
+		CrawlieReplay::SerializeFrame(Ar, Frames[(Oldest + i) % NumFrames]);
+	}
+
+	return FFileHelper::SaveArrayToFile(Bytes, *Path);
+}
+
+FCrawlieReplayPlayer::FCrawlieReplayPlayer(const FCrawlieReplay& InReplay)
+	: Replay(InReplay)
+{
+}
+
+int32 FCrawlieReplayPlayer::Play(APhyCrawlie& Crawler)
+{
+	if (Replay.Frames.IsEmpty())
+	{
+		return INDEX_NONE;
+	}
+
+	Crawler.BeginReplay(this, Replay.Frames[0].State);
+
+	int32 DivergedAt = INDEX_NONE;
+	for (Frame = 0; Frame < Replay.Frames.Num(); ++Frame)
+	{
+		const FCrawlieReplayFrame& Recorded = Replay.Frames[Frame];
+		if (Frame > 0 && !Crawler.CaptureReplayState().Matches(Recorded.State))
+		{
+			DivergedAt = Frame;
+			break;
+		}
+
+		Hit = 0;
+		bRanOutOfHits = false;
+		Crawler.TickCrawler(Recorded.DeltaTime);
+		if (bRanOutOfHits || Hit != Recorded.Hits.Num())
+		{
+			DivergedAt = Frame;
+			break;
+		}
+	}
+
+	Crawler.EndReplay();
+	return DivergedAt;
+}
+
+bool FCrawlieReplayPlayer::NextHit(FHitResult& OutHit)
+{
+	const TArray<FCrawlieRecordedHit>& Hits = Replay.Frames[Frame].Hits;
+	if (!Hits.IsValidIndex(Hit))
+	{
+		bRanOutOfHits = true;
+		OutHit = FHitResult();
+		return false;
+	}
+
+	Hits[Hit++].ToHitResult(OutHit);
+	return OutHit.bBlockingHit;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CrawlieState.h"
+
+class APhyCrawlie;
+class UCrawlieProfile;
+
+// Per-frame recording of a crawler's state and query results, for offline repro of stuck or
+// oscillating crawlers. Record with crawlie.Replay.Record 1 (or bRecordReplay on the actor), dump with
+// crawlie.Replay.Save, and play back with -run=CrawlieReplay -File=<path>.
+
+// What the decision code reads from a hit.
+struct FCrawlieRecordedHit
+{
+	FVector3f Location = FVector3f::ZeroVector;
+	FVector3f ImpactPoint = FVector3f::ZeroVector;
+	FVector3f Normal = FVector3f::ZeroVector;
+	FVector3f ImpactNormal = FVector3f::ZeroVector;
+	float Distance = 0;
+	bool bBlockingHit = false;
+
+	FCrawlieRecordedHit() = default;
+	explicit FCrawlieRecordedHit(const FHitResult& Hit);
+	void ToHitResult(FHitResult& OutHit) const;
+};
+
+// Everything the decision code carries from one frame to the next.
+struct FCrawlieReplayState
+{
+	FCrawlieHotState Hot;
+	FCrawlieTransition Transition;
+	int32 RandomSeed = 0;
+
+	bool Matches(const FCrawlieReplayState& Other) const;
+};
+
+struct FCrawlieReplayFrame
+{
+	// State at the start of the frame.
+	FCrawlieReplayState State;
+	float DeltaTime = 0;
+	// Query results in the order they were asked for.
+	TArray<FCrawlieRecordedHit> Hits;
+};
+
+struct FCrawlieReplay
+{
+	// Profile the crawler was recorded with. Empty for the class defaults.
+	FSoftObjectPath Profile;
+	TArray<FCrawlieReplayFrame> Frames;
+
+	static FString GetDefaultPath(const APhyCrawlie& Crawler);
+	bool Load(const FString& Path);
+};
+
+// Keeps the last N frames in a ring and writes them out oldest first.
+class PHY_API FCrawlieReplayRecorder
+{
+public:
+	explicit FCrawlieReplayRecorder(int32 InCapacity);
+
+	// Null unless recording is switched on, by bForce or crawlie.Replay.Record.
+	static TUniquePtr<FCrawlieReplayRecorder> CreateIfEnabled(bool bForce);
+
+	void BeginFrame(const FCrawlieReplayState& State, float DeltaTime);
+	void RecordHit(const FHitResult& Hit);
+	bool Save(const FString& Path, const UCrawlieProfile* Profile);
+
+private:
+	TArray<FCrawlieReplayFrame> Frames;
+	int32 Capacity = 0;
+	int32 Head = 0;
+	int32 Current = INDEX_NONE;
+};
+
+// Feeds recorded hits back to a crawler instead of querying the physics scene.
+class PHY_API FCrawlieReplayPlayer
+{
+public:
+	explicit FCrawlieReplayPlayer(const FCrawlieReplay& InReplay);
+
+	// Runs the decision code over every recorded frame. Returns the first frame where the crawler's
+	// state or query count no longer matches the recording, or INDEX_NONE if it stayed deterministic.
+	int32 Play(APhyCrawlie& Crawler);
+
+	bool NextHit(FHitResult& OutHit);
+
+private:
+	const FCrawlieReplay& Replay;
+	int32 Frame = 0;
+	int32 Hit = 0;
+	bool bRanOutOfHits = false;
+};
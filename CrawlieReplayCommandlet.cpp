@@ -0,0 +1,100 @@
+
+
+#include "CrawlieReplayCommandlet.h"
+#include "PhyCrawlie.h"
+#include "CrawlieProfile.h"
+#include "CrawlieReplay.h"
+#include "CrawlieStats.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+
+UCrawlieReplayCommandlet::UCrawlieReplayCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UCrawlieReplayCommandlet::Main(const FString& Params)
+{
+	FString Path;
+	int32 Loops = 100;
+	if (!FParse::Value(*Params, TEXT("File="), Path))
+	{
+		UE_LOG(LogCrawlie, Error, TEXT("Usage: -run=CrawlieReplay -File=<path.crpl> [-Loops=100]"));
+		return 1;
+	}
+	FParse::Value(*Params, TEXT("Loops="), Loops);
+	Loops = FMath::Max(Loops, 1);
+
+	FCrawlieReplay Replay;
+	if (!Replay.Load(Path))
+	{
+		UE_LOG(LogCrawlie, Error, TEXT("Could not load crawler replay %s"), *Path);
+		return 1;
+	}
+
+	UCrawlieProfile* Profile = nullptr;
+	if (!Replay.Profile.IsNull())
+	{
+		Profile = Cast<UCrawlieProfile>(Replay.Profile.TryLoad());
+		if (!Profile)
+		{
+			UE_LOG(LogCrawlie, Warning, TEXT("Could not load crawler profile %s, playing back with the defaults"), *Replay.Profile.ToString());
+		}
+	}
+
+	const ELogVerbosity::Type LogVerbosity = LogCrawlie.GetVerbosity();
+	if (!FParse::Param(*Params, TEXT("CrawlieLog")))
+	{
+		LogCrawlie.SetVerbosity(ELogVerbosity::Error);
+	}
+
+	// The crawler needs a world to live in, but every query is answered from the recording.
+	UWorld::InitializationValues InitValues;
+	InitValues.CreatePhysicsScene(false)
+		.ShouldSimulatePhysics(false)
+		.CreateNavigation(false)
+		.CreateAISystem(false)
+		.AllowAudioPlayback(false)
+		.RequiresHitProxies(false)
+		.SetTransactional(false);
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false, TEXT("CrawlieReplay"), nullptr, true, ERHIFeatureLevel::Num, &InitValues);
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	APhyCrawlie* Crawler = World->SpawnActor<APhyCrawlie>(SpawnParams);
+	Crawler->Profile = Profile;
+
+	FCrawlieReplayPlayer Player(Replay);
+	const int32 DivergedAt = Player.Play(*Crawler);
+
+	const double Start = FPlatformTime::Seconds();
+	for (int32 Loop = 0; Loop < Loops; ++Loop)
+	{
+		Player.Play(*Crawler);
+	}
+	const double Elapsed = FPlatformTime::Seconds() - Start;
+	LogCrawlie.SetVerbosity(LogVerbosity);
+
+	int32 NumHits = 0;
+	for (const FCrawlieReplayFrame& Frame : Replay.Frames)
+	{
+		NumHits += Frame.Hits.Num();
+	}
+
+	UE_LOG(LogCrawlie, Display, TEXT("%s: %d frames, %d recorded hits, %.3f us per frame over %d loops"),
+		*Path, Replay.Frames.Num(), NumHits,
+		Elapsed * 1.e6 / (double(Loops) * FMath::Max(Replay.Frames.Num(), 1)), Loops);
+
+	World->DestroyWorld(false);
+
+	if (DivergedAt != INDEX_NONE)
+	{
+		UE_LOG(LogCrawlie, Error, TEXT("Playback diverged from the recording at frame %d"), DivergedAt);
+		return 1;
+	}
+	UE_LOG(LogCrawlie, Display, TEXT("Playback matched the recording"));
+	return 0;
+}
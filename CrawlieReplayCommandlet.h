@@ -0,0 +1,19 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CrawlieReplayCommandlet.generated.h"
+
+// Plays a recorded crawler replay back against its recorded hits, with no physics scene, to check the
+// decision code is deterministic and to time it on its own:
+//   UnrealEditor-Cmd <Project>.uproject -run=CrawlieReplay -nullrhi -File=<path.crpl> [-Loops=100] [-CrawlieLog]
+UCLASS()
+class PHY_API UCrawlieReplayCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UCrawlieReplayCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
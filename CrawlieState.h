@@ -0,0 +1,111 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Runtime state of a crawler, kept out of reflection and packed so a swarm's tick loop stays in cache.
+
+enum class ECrawlieFlags : uint8
+{
+	None = 0,
+	GoingUp = 1 << 0,
+	GoingDown = 1 << 1,
+	WithoutFloor = 1 << 2,
+	Restored = 1 << 3,
+	// Bookkeeping for the swarm, not part of the crawler's behaviour and not recorded in replays.
+	SwarmTicked = 1 << 4,
+	Recording = 1 << 5,
+	Bookkeeping = SwarmTicked | Recording,
+};
+ENUM_CLASS_FLAGS(ECrawlieFlags);
+
+// Location and rotation without scale. The location is in double precision like the actor's, so
+// crawlers far from the world origin don't snap to a float grid; the rotation doesn't need it.
+struct FCrawliePose
+{
+	FVector Location = FVector::ZeroVector;
+	FQuat4f Rotation = FQuat4f::Identity;
+
+	FCrawliePose() = default;
+	FCrawliePose(const FVector& InLocation, const FQuat& InRotation)
+		: Location(InLocation)
+		, Rotation(InRotation)
+	{
+	}
+	FCrawliePose(const FVector& InLocation, const FQuat4f& InRotation)
+		: Location(InLocation)
+		, Rotation(InRotation)
+	{
+	}
+
+	FVector GetLocation() const { return Location; }
+	FQuat GetRotation() const { return FQuat(Rotation); }
+};
+
+// Read and written every tick. Stored contiguously by the swarm (see UCrawlieSwarmSubsystem), so
+// anything only needed on some frames belongs on the actor or in FCrawlieTransition. Aligned to a
+// cache line so each crawler's slot is exactly one, given storage that honours the alignment.
+struct alignas(64) FCrawlieHotState
+{
+	// Pose in surface-local 2D: walking integrates U, V and Heading (radians) on the plane given by
+	// Origin and Basis, so the world rotation is rebuilt from two exact values instead of accumulated.
+	// Only Origin is in world space, so only it needs double precision; U and V stay small.
+	FQuat4f Basis = FQuat4f::Identity;
+	FVector Origin = FVector::ZeroVector;
+	float U = 0;
+	float V = 0;
+	float Heading = 0;
+
+	float TimeUntilTurnRateChange = 0;
+	float ForwardSpeed = 0;
+	int16 TurnRateInDegrees = 0;
+	ECrawlieFlags Flags = ECrawlieFlags::None;
+
+	bool Has(ECrawlieFlags Flag) const { return EnumHasAnyFlags(Flags, Flag); }
+	void Set(ECrawlieFlags Flag, bool bValue)
+	{
+		if (bValue) Flags |= Flag;
+		else Flags &= ~Flag;
+	}
+
+	FVector GetLocation() const { return Origin + FVector(Basis.RotateVector(FVector3f(U, V, 0))); }
+	FQuat4f GetRotation() const { return Basis * FQuat4f(FVector3f::UpVector, Heading); }
+	FCrawliePose GetPose() const { return FCrawliePose(GetLocation(), GetRotation()); }
+
+	// Start a new surface frame at the given pose.
+	void ResetSurfaceFrame(const FVector& Location, const FQuat4f& Rotation)
+	{
+		Origin = Location;
+		Basis = Rotation;
+		U = 0;
+		V = 0;
+		Heading = 0;
+	}
+
+	// Walk along the surface plane for one step.
+	void Move(float DeltaTime)
+	{
+		Heading = FMath::UnwindRadians(Heading + FMath::DegreesToRadians(float(TurnRateInDegrees)) * DeltaTime);
+
+		float Sin, Cos;
+		FMath::SinCos(&Sin, &Cos, Heading);
+		const float Distance = ForwardSpeed * DeltaTime;
+		U += Cos * Distance;
+		V += Sin * Distance;
+	}
+
+	// Counts down to the next turn rate change. True once it is due.
+	bool TickTurnRateTimer(float DeltaTime)
+	{
+		TimeUntilTurnRateChange -= DeltaTime;
+		return TimeUntilTurnRateChange < 0;
+	}
+};
+static_assert(sizeof(FCrawlieHotState) == 64, "Crawler hot state should take exactly one cache line");
+
+// Only touched while moving between surfaces.
+struct FCrawlieTransition
+{
+	FCrawliePose From;
+	FCrawliePose To;
+	float LerpValue = 0;
+};
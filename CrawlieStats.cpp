@@ -0,0 +1,36 @@
+
+
+#include "CrawlieStats.h"
+
+DEFINE_LOG_CATEGORY(LogCrawlie);
+
+DEFINE_STAT(STAT_CrawlieTick);
+DEFINE_STAT(STAT_CrawlieSwarmIntegrate);
+DEFINE_STAT(STAT_CrawlieSwarmSense);
+DEFINE_STAT(STAT_CrawlieSwarmDecide);
+DEFINE_STAT(STAT_CrawlieSwarmCommit);
+DEFINE_STAT(STAT_CrawlieMove);
+DEFINE_STAT(STAT_CrawlieCommitTransform);
+DEFINE_STAT(STAT_CrawlieGoToNewSurface);
+DEFINE_STAT(STAT_CrawlieTraceForBarrier);
+DEFINE_STAT(STAT_CrawlieTraceAheadLow);
+DEFINE_STAT(STAT_CrawlieTraceAheadMid);
+DEFINE_STAT(STAT_CrawlieTraceAheadHigh);
+DEFINE_STAT(STAT_CrawlieTraceFloorCenter);
+DEFINE_STAT(STAT_CrawlieTraceFloorSubsteps);
+DEFINE_STAT(STAT_CrawlieTraceFloorLower);
+DEFINE_STAT(STAT_CrawlieTraceFloorFlipside);
+DEFINE_STAT(STAT_CrawlieTraceFloorClassify);
+
+DEFINE_STAT(STAT_CrawlieRaysCast);
+DEFINE_STAT(STAT_CrawlieTransitionsStarted);
+DEFINE_STAT(STAT_CrawliesWalking);
+DEFINE_STAT(STAT_CrawliesGoingUp);
+DEFINE_STAT(STAT_CrawliesGoingDown);
+DEFINE_STAT(STAT_CrawliesWithoutFloor);
+DEFINE_STAT(STAT_CrawliesDormant);
+
+std::atomic<uint64> GCrawlieRaysCast = 0;
+
+UE_TRACE_CHANNEL_DEFINE(CrawlieChannel);
+UE_TRACE_CHANNEL_DEFINE(CrawlieQueryChannel);
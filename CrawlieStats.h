@@ -0,0 +1,56 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+#include "Stats/Stats.h"
+#include "Trace/Trace.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+// Crawler profiling. Works headless (-nullrhi) on the build farm:
+//   stat group:  "stat Crawlie", or "stat startfile" / "stat stopfile" for a .ue4stats capture
+//   insights:    -trace=cpu,crawlie,crawliequery  (add -statnamedevents to get the stat scopes as well)
+
+DECLARE_LOG_CATEGORY_EXTERN(LogCrawlie, Log, All);
+
+DECLARE_STATS_GROUP(TEXT("Crawlie"), STATGROUP_Crawlie, STATCAT_Advanced);
+
+// The whole crawler step, for crawlers on their own actor tick only (crawlie.Swarm.GroupTick 0, a
+// Blueprint Event Tick, or replay playback). Swarm-ticked crawlers show up under the Swarm phases.
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Tick"), STAT_CrawlieTick, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Swarm Integrate"), STAT_CrawlieSwarmIntegrate, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Swarm Sense"), STAT_CrawlieSwarmSense, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Swarm Decide"), STAT_CrawlieSwarmDecide, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Swarm Commit"), STAT_CrawlieSwarmCommit, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Move"), STAT_CrawlieMove, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("CommitTransform"), STAT_CrawlieCommitTransform, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("GoToNewSurface"), STAT_CrawlieGoToNewSurface, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("TraceForBarrier"), STAT_CrawlieTraceForBarrier, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("TraceAhead Low"), STAT_CrawlieTraceAheadLow, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("TraceAhead Mid"), STAT_CrawlieTraceAheadMid, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("TraceAhead High"), STAT_CrawlieTraceAheadHigh, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("TraceFloor Center"), STAT_CrawlieTraceFloorCenter, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("TraceFloor Substeps"), STAT_CrawlieTraceFloorSubsteps, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("TraceFloor Lower"), STAT_CrawlieTraceFloorLower, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("TraceFloor Flipside"), STAT_CrawlieTraceFloorFlipside, STATGROUP_Crawlie, PHY_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("TraceFloor Classify"), STAT_CrawlieTraceFloorClassify, STATGROUP_Crawlie, PHY_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Rays cast"), STAT_CrawlieRaysCast, STATGROUP_Crawlie, PHY_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Transitions started"), STAT_CrawlieTransitionsStarted, STATGROUP_Crawlie, PHY_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Crawlers walking"), STAT_CrawliesWalking, STATGROUP_Crawlie, PHY_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Crawlers going up"), STAT_CrawliesGoingUp, STATGROUP_Crawlie, PHY_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Crawlers going down"), STAT_CrawliesGoingDown, STATGROUP_Crawlie, PHY_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Crawlers without floor"), STAT_CrawliesWithoutFloor, STATGROUP_Crawlie, PHY_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Crawlers dormant"), STAT_CrawliesDormant, STATGROUP_Crawlie, PHY_API);
+
+// Running total of CrawlieRaysCast for tools that can't read stats, e.g. the stress commandlet.
+// Atomic because the sense phase can run on worker threads.
+extern PHY_API std::atomic<uint64> GCrawlieRaysCast;
+
+// Insights channels. "Crawlie" carries the pipeline scopes, "CrawlieQuery" one event per ray.
+UE_TRACE_CHANNEL_EXTERN(CrawlieChannel, PHY_API);
+UE_TRACE_CHANNEL_EXTERN(CrawlieQueryChannel, PHY_API);
+
+// Times a scope both as a stat and as an Insights event on the Crawlie channel.
+#define CRAWLIE_SCOPE_CYCLE_COUNTER(Stat) \
+	SCOPE_CYCLE_COUNTER(Stat); \
+	TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(Stat, CrawlieChannel)
@@ -0,0 +1,389 @@
+
+
+#include "CrawlieStressCommandlet.h"
+#include "PhyCrawlie.h"
+#include "CrawlieProfile.h"
+#include "CrawlieStats.h"
+#include "Components/BoxComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/CollisionProfile.h"
+#include "Engine/Engine.h"
+#include "Engine/GameInstance.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/StaticMeshActor.h"
+#include "Engine/World.h"
+#include "HAL/PlatformMemory.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+namespace CrawlieStress
+{
+	constexpr float CellSize = 2000;
+	constexpr int32 CrawlersPerCell = 100;
+	constexpr float BarrierHeight = 400;
+	constexpr float BarrierThickness = 20;
+
+	// The crawler's runtime members as they were before being packed into FCrawlieHotState and
+	// FCrawlieTransition, so the report can show the packing's saving with this compiler and engine.
+	struct FUnpackedCrawlerState
+	{
+		float DTime;
+		float ColliderRadius;
+		float ForwardSpeed;
+		float TraceAheadDistance;
+		float MaxStepHeight;
+		int CurrentTurnRateInDegrees;
+		float TimeOfNextTurnRateChange;
+		bool bIsSwitchingSurface;
+		bool bIsGoingUp;
+		bool bIsGoingDown;
+		int SurfaceSwitchesDone;
+		FTransform OldTransform;
+		FTransform TargetTransform;
+		bool bIsWallAhead;
+		bool bGapAhead;
+		FHitResult LastVoidHit;
+		float LerpValue;
+		bool bIsWithoutFloor;
+	};
+}
+
+UCrawlieStressCommandlet::UCrawlieStressCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UCrawlieStressCommandlet::Main(const FString& Params)
+{
+	int32 NumCrawlers = 10000;
+	float Seconds = 30;
+	float FrameRate = 30;
+	int32 Seed = 1;
+	float StuckSeconds = 2;
+	FString ReportPath = FPaths::ProjectSavedDir() / TEXT("Crawlie") / TEXT("StressReport.json");
+	FParse::Value(*Params, TEXT("Crawlers="), NumCrawlers);
+	FParse::Value(*Params, TEXT("Seconds="), Seconds);
+	FParse::Value(*Params, TEXT("FrameRate="), FrameRate);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	FParse::Value(*Params, TEXT("StuckSeconds="), StuckSeconds);
+	FParse::Value(*Params, TEXT("Report="), ReportPath);
+	FString ProfilePath;
+	if (FParse::Value(*Params, TEXT("Profile="), ProfilePath))
+	{
+		Profile = LoadObject<UCrawlieProfile>(nullptr, *ProfilePath);
+		if (!Profile)
+		{
+			UE_LOG(LogCrawlie, Error, TEXT("Could not load crawler profile %s"), *ProfilePath);
+			return 1;
+		}
+	}
+	// A report from a run of an earlier build, whose memory numbers are reported next to this run's.
+	FString BaselinePath;
+	double BaselineMemoryPerCrawler = 0;
+	int32 BaselineObjectBytes = 0;
+	if (FParse::Value(*Params, TEXT("Baseline="), BaselinePath))
+	{
+		FString BaselineReport;
+		if (!FFileHelper::LoadFileToString(BaselineReport, *BaselinePath) ||
+			!FParse::Value(*BaselineReport, TEXT("\"memory_per_crawler_bytes\":"), BaselineMemoryPerCrawler) ||
+			!FParse::Value(*BaselineReport, TEXT("\"crawler_object_bytes\":"), BaselineObjectBytes))
+		{
+			UE_LOG(LogCrawlie, Error, TEXT("Could not read memory numbers from baseline report %s"), *BaselinePath);
+			return 1;
+		}
+	}
+	NumCrawlers = FMath::Max(NumCrawlers, 1);
+	FrameRate = FMath::Max(FrameRate, 1.f);
+
+	// Every crawler logs its decisions, which would dominate the frame time.
+	const ELogVerbosity::Type LogVerbosity = LogCrawlie.GetVerbosity();
+	if (!FParse::Param(*Params, TEXT("CrawlieLog")))
+	{
+		LogCrawlie.SetVerbosity(ELogVerbosity::Error);
+	}
+
+	// A game instance and game mode, so BeginPlay reaches StartPlay and the world (and every crawler
+	// spawned into it) actually begins play.
+	GameInstance = NewObject<UGameInstance>(GEngine);
+	GameInstance->InitializeStandalone(TEXT("CrawlieStress"));
+	UWorld* World = GameInstance->GetWorld();
+	const FURL URL;
+	World->SetGameMode(URL);
+	World->InitializeActorsForPlay(URL);
+	World->BeginPlay();
+	if (!World->HasBegunPlay())
+	{
+		LogCrawlie.SetVerbosity(LogVerbosity);
+		UE_LOG(LogCrawlie, Error, TEXT("The stress world did not begin play"));
+		DestroyWorld(World);
+		return 1;
+	}
+
+	const float DeltaSeconds = 1.f / FrameRate;
+	const int32 CellsPerSide = FMath::Max(1, FMath::CeilToInt(FMath::Sqrt(float(NumCrawlers) / CrawlieStress::CrawlersPerCell)));
+	FRandomStream Stream(Seed);
+
+	BuildCourse(World, CellsPerSide, Stream);
+	// Let the physics scene pick up the course before we trace against it.
+	World->Tick(LEVELTICK_All, DeltaSeconds);
+
+	const uint64 MemoryBeforeSpawn = FPlatformMemory::GetStats().UsedPhysical;
+	SpawnCrawlers(World, CellsPerSide, NumCrawlers, Stream);
+	const uint64 MemoryAfterSpawn = FPlatformMemory::GetStats().UsedPhysical;
+	if (Crawlers.IsEmpty() || !Crawlers[0]->HasActorBegunPlay())
+	{
+		LogCrawlie.SetVerbosity(LogVerbosity);
+		UE_LOG(LogCrawlie, Error, TEXT("No crawlers are running (%d spawned)"), Crawlers.Num());
+		DestroyWorld(World);
+		return 1;
+	}
+
+	const int32 NumFrames = FMath::Max(1, FMath::RoundToInt(Seconds * FrameRate));
+	TArray<double> FrameTimesMs;
+	FrameTimesMs.Reserve(NumFrames);
+	const uint64 RaysBefore = GCrawlieRaysCast;
+
+	// Frames in a row each crawler has been without floor, and the longest such run, sampled outside
+	// the timed part of the frame.
+	TArray<int32> RunWithoutFloor;
+	TArray<int32> LongestRunWithoutFloor;
+	RunWithoutFloor.SetNumZeroed(Crawlers.Num());
+	LongestRunWithoutFloor.SetNumZeroed(Crawlers.Num());
+
+	for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+	{
+		const double FrameStart = FPlatformTime::Seconds();
+		World->Tick(LEVELTICK_All, DeltaSeconds);
+		FrameTimesMs.Add((FPlatformTime::Seconds() - FrameStart) * 1000.0);
+		++GFrameCounter;
+
+		for (int32 i = 0; i < Crawlers.Num(); ++i)
+		{
+			if (IsValid(Crawlers[i]) && Crawlers[i]->IsWithoutFloor())
+			{
+				LongestRunWithoutFloor[i] = FMath::Max(LongestRunWithoutFloor[i], ++RunWithoutFloor[i]);
+			}
+			else
+			{
+				RunWithoutFloor[i] = 0;
+			}
+		}
+	}
+
+	const uint64 RaysCast = GCrawlieRaysCast - RaysBefore;
+	LogCrawlie.SetVerbosity(LogVerbosity);
+
+	double TotalMs = 0;
+	for (double FrameMs : FrameTimesMs)
+	{
+		TotalMs += FrameMs;
+	}
+	TArray<double> SortedMs = FrameTimesMs;
+	SortedMs.Sort();
+	const double AverageMs = TotalMs / SortedMs.Num();
+	const double P99Ms = SortedMs[FMath::Clamp(FMath::CeilToInt(SortedMs.Num() * 0.99) - 1, 0, SortedMs.Num() - 1)];
+
+	// Stuck means without floor for StuckSeconds straight at some point in the run, not just on the last frame.
+	const int32 StuckFrames = FMath::Max(1, FMath::RoundToInt(StuckSeconds * FrameRate));
+	int32 NumStuck = 0;
+	int32 NumEverWithoutFloor = 0;
+	int32 LongestRun = 0;
+	for (int32 Run : LongestRunWithoutFloor)
+	{
+		NumStuck += Run >= StuckFrames ? 1 : 0;
+		NumEverWithoutFloor += Run > 0 ? 1 : 0;
+		LongestRun = FMath::Max(LongestRun, Run);
+	}
+
+	const int64 SpawnedMemory = int64(MemoryAfterSpawn) - int64(MemoryBeforeSpawn);
+	const double MemoryPerCrawler = double(SpawnedMemory) / FMath::Max(Crawlers.Num(), 1);
+	const int32 ObjectBytes = APhyCrawlie::StaticClass()->GetStructureSize();
+	FString BaselineFields;
+	if (!BaselinePath.IsEmpty())
+	{
+		BaselineFields = FString::Printf(TEXT(
+			"\t\"baseline_memory_per_crawler_bytes\": %.1f,\n"
+			"\t\"baseline_crawler_object_bytes\": %d,\n"
+			"\t\"memory_per_crawler_delta_bytes\": %.1f,\n"
+			"\t\"crawler_object_delta_bytes\": %d,\n"),
+			BaselineMemoryPerCrawler,
+			BaselineObjectBytes,
+			MemoryPerCrawler - BaselineMemoryPerCrawler,
+			ObjectBytes - BaselineObjectBytes);
+	}
+
+	const FString Report = FString::Printf(TEXT(
+		"{\n"
+		"\t\"crawlers\": %d,\n"
+		"\t\"frames\": %d,\n"
+		"\t\"frame_rate\": %.2f,\n"
+		"\t\"seed\": %d,\n"
+		"\t\"frame_time_avg_ms\": %.4f,\n"
+		"\t\"frame_time_p99_ms\": %.4f,\n"
+		"\t\"rays_per_frame\": %.2f,\n"
+		"\t\"stuck_seconds\": %.2f,\n"
+		"\t\"stuck_crawlers\": %d,\n"
+		"\t\"crawlers_ever_without_floor\": %d,\n"
+		"\t\"longest_without_floor_seconds\": %.2f,\n"
+		"%s"
+		"\t\"memory_per_crawler_bytes\": %.1f,\n"
+		"\t\"crawler_object_bytes\": %d,\n"
+		"\t\"crawler_unpacked_state_bytes\": %d,\n"
+		"\t\"crawler_hot_state_bytes\": %d,\n"
+		"\t\"crawler_transition_bytes\": %d\n"
+		"}\n"),
+		Crawlers.Num(),
+		NumFrames,
+		FrameRate,
+		Seed,
+		AverageMs,
+		P99Ms,
+		double(RaysCast) / NumFrames,
+		StuckSeconds,
+		NumStuck,
+		NumEverWithoutFloor,
+		LongestRun / FrameRate,
+		*BaselineFields,
+		MemoryPerCrawler,
+		ObjectBytes,
+		int32(sizeof(CrawlieStress::FUnpackedCrawlerState)),
+		int32(sizeof(FCrawlieHotState)),
+		int32(sizeof(FCrawlieTransition)));
+
+	UE_LOG(LogCrawlie, Display, TEXT("Crawlie stress report:\n%s"), *Report);
+
+	DestroyWorld(World);
+
+	if (!FFileHelper::SaveStringToFile(Report, *ReportPath))
+	{
+		UE_LOG(LogCrawlie, Error, TEXT("Could not write stress report to %s"), *ReportPath);
+		return 1;
+	}
+
+	// A run where nothing probed measured an idle world, not the crawlers.
+	if (RaysCast == 0)
+	{
+		UE_LOG(LogCrawlie, Error, TEXT("Crawlers cast no rays, the report does not measure them"));
+		return 1;
+	}
+	return 0;
+}
+
+void UCrawlieStressCommandlet::DestroyWorld(UWorld* World)
+{
+	Crawlers.Empty();
+	GameInstance->Shutdown();
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+	GameInstance = nullptr;
+}
+
+void UCrawlieStressCommandlet::BuildCourse(UWorld* World, int32 CellsPerSide, FRandomStream& Stream) const
+{
+	using namespace CrawlieStress;
+
+	UStaticMesh* Cube = LoadObject<UStaticMesh>(nullptr, TEXT("/Engine/BasicShapes/Cube.Cube"));
+	const float HalfCell = CellSize / 2;
+
+	for (int32 X = 0; X < CellsPerSide; ++X)
+	{
+		for (int32 Y = 0; Y < CellsPerSide; ++Y)
+		{
+			const FVector Origin(X * CellSize, Y * CellSize, 0);
+
+			// Floor, top at Origin.Z
+			SpawnBlock(World, Cube, Origin + FVector(0, 0, -10), FVector(CellSize, CellSize, 20));
+
+			// Wall to climb
+			const float WallHeight = Stream.FRandRange(150, 300);
+			SpawnBlock(World, Cube,
+				Origin + FVector(Stream.FRandRange(-HalfCell, HalfCell) * 0.6f, Stream.FRandRange(-HalfCell, HalfCell) * 0.6f, WallHeight / 2),
+				FVector(20, Stream.FRandRange(200, 600), WallHeight),
+				FRotator(0, Stream.FRandRange(0, 180), 0));
+
+			// Ledge to step up on and down from
+			const float LedgeHeight = Stream.FRandRange(20, 60);
+			SpawnBlock(World, Cube,
+				Origin + FVector(Stream.FRandRange(-HalfCell, HalfCell) * 0.6f, Stream.FRandRange(-HalfCell, HalfCell) * 0.6f, LedgeHeight / 2),
+				FVector(Stream.FRandRange(200, 400), Stream.FRandRange(200, 400), LedgeHeight),
+				FRotator(0, Stream.FRandRange(0, 180), 0));
+
+			// Thin plank to wrap around
+			SpawnBlock(World, Cube,
+				Origin + FVector(Stream.FRandRange(-HalfCell, HalfCell) * 0.6f, Stream.FRandRange(-HalfCell, HalfCell) * 0.6f, Stream.FRandRange(40, 120)),
+				FVector(Stream.FRandRange(300, 600), 60, 2),
+				FRotator(0, Stream.FRandRange(0, 180), 0));
+
+			// Barrier boxes around the cell, and one loose inside it
+			SpawnBarrier(World, Origin + FVector(HalfCell, 0, BarrierHeight / 2), FVector(BarrierThickness, CellSize, BarrierHeight));
+			SpawnBarrier(World, Origin + FVector(-HalfCell, 0, BarrierHeight / 2), FVector(BarrierThickness, CellSize, BarrierHeight));
+			SpawnBarrier(World, Origin + FVector(0, HalfCell, BarrierHeight / 2), FVector(CellSize, BarrierThickness, BarrierHeight));
+			SpawnBarrier(World, Origin + FVector(0, -HalfCell, BarrierHeight / 2), FVector(CellSize, BarrierThickness, BarrierHeight));
+			SpawnBarrier(World,
+				Origin + FVector(Stream.FRandRange(-HalfCell, HalfCell) * 0.6f, Stream.FRandRange(-HalfCell, HalfCell) * 0.6f, 50),
+				FVector(100, 100, 100));
+		}
+	}
+}
+
+void UCrawlieStressCommandlet::SpawnCrawlers(UWorld* World, int32 CellsPerSide, int32 NumCrawlers, FRandomStream& Stream)
+{
+	using namespace CrawlieStress;
+
+	const float Radius = (Profile ? Profile : GetDefault<UCrawlieProfile>())->ColliderRadius;
+	const float Inset = CellSize / 2 - 100;
+	const int32 NumCells = CellsPerSide * CellsPerSide;
+
+	Crawlers.Reserve(NumCrawlers);
+	for (int32 i = 0; i < NumCrawlers; ++i)
+	{
+		const int32 Cell = i % NumCells;
+		const FVector Origin((Cell / CellsPerSide) * CellSize, (Cell % CellsPerSide) * CellSize, 0);
+		const FVector Above = Origin + FVector(Stream.FRandRange(-Inset, Inset), Stream.FRandRange(-Inset, Inset), 1000);
+
+		// Drop onto whatever is there, so some crawlers start on walls, ledges and planks.
+		FHitResult Hit;
+		if (!World->LineTraceSingleByChannel(Hit, Above, Above - FVector(0, 0, 1100), ECC_WorldStatic))
+		{
+			continue;
+		}
+
+		const FVector Location = Hit.ImpactPoint + Hit.ImpactNormal * Radius;
+		const FTransform Transform(FRotationMatrix::MakeFromZ(Hit.ImpactNormal).Rotator(), Location);
+		if (APhyCrawlie* Crawler = World->SpawnActorDeferred<APhyCrawlie>(APhyCrawlie::StaticClass(), Transform, nullptr, nullptr,
+			ESpawnActorCollisionHandlingMethod::AlwaysSpawn))
+		{
+			Crawler->Profile = Profile;
+			Crawler->FinishSpawning(Transform);
+			Crawlers.Add(Crawler);
+		}
+	}
+}
+
+AActor* UCrawlieStressCommandlet::SpawnBlock(UWorld* World, UStaticMesh* Cube, const FVector& Center, const FVector& Size, const FRotator& Rotation) const
+{
+	// The engine cube is 100 units on a side
+	const FTransform Transform(Rotation, Center, Size / 100);
+	AStaticMeshActor* Block = World->SpawnActorDeferred<AStaticMeshActor>(AStaticMeshActor::StaticClass(), Transform);
+	Block->GetStaticMeshComponent()->SetStaticMesh(Cube);
+	Block->GetStaticMeshComponent()->SetCollisionProfileName(UCollisionProfile::BlockAll_ProfileName);
+	Block->FinishSpawning(Transform);
+	return Block;
+}
+
+AActor* UCrawlieStressCommandlet::SpawnBarrier(UWorld* World, const FVector& Center, const FVector& Size) const
+{
+	AActor* Barrier = World->SpawnActor<AActor>(AActor::StaticClass(), FTransform(Center));
+	UBoxComponent* Box = NewObject<UBoxComponent>(Barrier, TEXT("Box"));
+	Box->SetBoxExtent(Size / 2);
+	Box->SetCollisionEnabled(ECollisionEnabled::QueryOnly);
+	Box->SetCollisionResponseToAllChannels(ECR_Ignore);
+	Box->SetCollisionResponseToChannel(ECC_GameTraceChannel2, ECR_Block);
+	Barrier->SetRootComponent(Box);
+	Box->SetWorldLocation(Center);
+	Box->RegisterComponent();
+	return Barrier;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CrawlieStressCommandlet.generated.h"
+
+class APhyCrawlie;
+class UGameInstance;
+class UCrawlieProfile;
+
+// Headless crawler perf gate. Builds a procedural course, spawns crawlers on it, ticks the world
+// at a fixed rate and writes a JSON report. Runs without a GPU:
+//   UnrealEditor-Cmd <Project>.uproject -run=CrawlieStress -nullrhi -unattended
+//     [-Crawlers=10000] [-Seconds=30] [-FrameRate=30] [-Seed=1] [-StuckSeconds=2] [-Report=<path>] [-Profile=<asset path>] [-CrawlieLog]
+//     [-Baseline=<report of an earlier build>]
+// The memory section compares against the crawler's layout from before its state was packed, and,
+// given -Baseline, against the per-crawler and object bytes that build measured.
+// Fails when the world doesn't begin play, no crawler gets running, or the crawlers cast no rays.
+UCLASS()
+class PHY_API UCrawlieStressCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UCrawlieStressCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	void BuildCourse(UWorld* World, int32 CellsPerSide, FRandomStream& Stream) const;
+	void SpawnCrawlers(UWorld* World, int32 CellsPerSide, int32 NumCrawlers, FRandomStream& Stream);
+	AActor* SpawnBlock(UWorld* World, UStaticMesh* Cube, const FVector& Center, const FVector& Size, const FRotator& Rotation = FRotator::ZeroRotator) const;
+	AActor* SpawnBarrier(UWorld* World, const FVector& Center, const FVector& Size) const;
+	void DestroyWorld(UWorld* World);
+
+	UPROPERTY()
+	UGameInstance* GameInstance = nullptr;
+
+	UPROPERTY()
+	TArray<APhyCrawlie*> Crawlers;
+
+	UPROPERTY()
+	UCrawlieProfile* Profile = nullptr;
+};
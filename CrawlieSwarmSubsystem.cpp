@@ -0,0 +1,451 @@
+
+
+#include "CrawlieSwarmSubsystem.h"
+#include "PhyCrawlie.h"
+#include "CrawlieStats.h"
+#include "Async/ParallelFor.h"
+#include "Components/PrimitiveComponent.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "Engine/Level.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarCrawlieGroupTick(
+	TEXT("crawlie.Swarm.GroupTick"),
+	1,
+	TEXT("Tick crawlers in phases from the swarm instead of one actor tick each. Read when the world begins play."));
+
+static TAutoConsoleVariable<int32> CVarCrawlieParallelSense(
+	TEXT("crawlie.Swarm.ParallelSense"),
+	0,
+	TEXT("Split the sense and decide phases over worker threads in groups of crawlie.Swarm.GroupSize, with the game thread waiting.\n")
+	TEXT("Read when the world begins play."));
+
+static TAutoConsoleVariable<int32> CVarCrawlieGroupSize(
+	TEXT("crawlie.Swarm.GroupSize"),
+	64,
+	TEXT("Crawlers per worker task when the sense phase runs in parallel."));
+
+void FCrawliePhaseTickFunction::ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (Swarm && TickType != LEVELTICK_ViewportsOnly)
+	{
+		Swarm->TickPhase(Phase, DeltaTime);
+	}
+}
+
+FString FCrawliePhaseTickFunction::DiagnosticMessage()
+{
+	static const TCHAR* const PhaseNames[] = { TEXT("Integrate"), TEXT("Sense"), TEXT("Decide"), TEXT("Commit") };
+	return FString::Printf(TEXT("UCrawlieSwarmSubsystem[%s]"), PhaseNames[int32(Phase)]);
+}
+
+FName FCrawliePhaseTickFunction::DiagnosticContext(bool bDetailed)
+{
+	return FName(TEXT("CrawlieSwarm"));
+}
+
+bool UCrawlieSwarmSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UCrawlieSwarmSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	PreLevelRemovedHandle = FWorldDelegates::PreLevelRemovedFromWorld.AddUObject(this, &UCrawlieSwarmSubsystem::OnPreLevelRemoved);
+	LevelAddedHandle = FWorldDelegates::LevelAddedToWorld.AddUObject(this, &UCrawlieSwarmSubsystem::OnLevelAdded);
+}
+
+void UCrawlieSwarmSubsystem::Deinitialize()
+{
+	FWorldDelegates::PreLevelRemovedFromWorld.Remove(PreLevelRemovedHandle);
+	FWorldDelegates::LevelAddedToWorld.Remove(LevelAddedHandle);
+
+	for (FCrawliePhaseTickFunction& PhaseTick : PhaseTicks)
+	{
+		if (PhaseTick.IsTickFunctionRegistered())
+		{
+			PhaseTick.UnRegisterTickFunction();
+		}
+	}
+
+	DEC_DWORD_STAT_BY(STAT_CrawliesDormant, NumDormantRecords);
+	DormantLevels.Empty();
+	NumDormantRecords = 0;
+
+	// Crawlers can outlive the subsystem while the world tears down.
+	for (APhyCrawlie* Crawler : Crawlers)
+	{
+		if (Crawler)
+		{
+			DetachHotState(*Crawler);
+		}
+	}
+	Crawlers.Empty();
+	HotStates.Empty();
+
+	Super::Deinitialize();
+}
+
+void UCrawlieSwarmSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	bGroupTick = CVarCrawlieGroupTick.GetValueOnGameThread() != 0;
+	bParallelSense = CVarCrawlieParallelSense.GetValueOnGameThread() != 0;
+	if (!bGroupTick)
+	{
+		return;
+	}
+
+	// Sensing overlaps the physics step. Commit waits for it, and animation waits for commit (see
+	// TakeOverTick for the mesh's tick group).
+	//
+	// Every phase ticks on the game thread, parallel sense included: Sense and Decide fan out with
+	// ParallelFor, which blocks the game thread until the last group is done. So no game-thread tick
+	// (no other actor, component or Blueprint) runs while the workers read crawler and world state,
+	// and nothing can spawn or destroy a crawler and move the hot state under them. The workers only
+	// run scene queries, which are safe against the physics step running alongside in DuringPhysics.
+	static const ETickingGroup PhaseGroups[] = { TG_PrePhysics, TG_DuringPhysics, TG_DuringPhysics, TG_DuringPhysics };
+	for (int32 Phase = 0; Phase < int32(ECrawliePhase::Num); ++Phase)
+	{
+		FCrawliePhaseTickFunction& PhaseTick = PhaseTicks[Phase];
+		PhaseTick.Swarm = this;
+		PhaseTick.Phase = ECrawliePhase(Phase);
+		PhaseTick.bCanEverTick = true;
+		PhaseTick.bStartWithTickEnabled = true;
+		PhaseTick.TickGroup = PhaseGroups[Phase];
+		if (Phase > 0)
+		{
+			PhaseTick.AddPrerequisite(this, PhaseTicks[Phase - 1]);
+		}
+		PhaseTick.RegisterTickFunction(InWorld.PersistentLevel);
+	}
+
+	// Anything that began play before the world did.
+	for (APhyCrawlie* Crawler : Crawlers)
+	{
+		if (Crawler && Crawler->HasActorBegunPlay())
+		{
+			TakeOverTick(Crawler);
+		}
+	}
+}
+
+void UCrawlieSwarmSubsystem::Register(APhyCrawlie* Crawler)
+{
+	if (bGroupTick)
+	{
+		TakeOverTick(Crawler);
+	}
+}
+
+void UCrawlieSwarmSubsystem::Unregister(APhyCrawlie* Crawler)
+{
+	FCrawlieHotState& Hot = HotStates[Crawler->HotHandle];
+	if (!Hot.Has(ECrawlieFlags::SwarmTicked))
+	{
+		return;
+	}
+
+	Hot.Set(ECrawlieFlags::SwarmTicked, false);
+	if (USkeletalMeshComponent* Mesh = Crawler->SkeletalMesh)
+	{
+		Mesh->PrimaryComponentTick.RemovePrerequisite(this, PhaseTicks[int32(ECrawliePhase::Commit)]);
+		if (const USkeletalMeshComponent* Archetype = Cast<USkeletalMeshComponent>(Mesh->GetArchetype()))
+		{
+			Mesh->SetTickGroup(Archetype->PrimaryComponentTick.TickGroup);
+		}
+	}
+}
+
+void UCrawlieSwarmSubsystem::AcquireHotState(APhyCrawlie* Crawler)
+{
+	Crawler->Swarm = this;
+	Crawler->HotHandle = HotStates.Num();
+	Crawlers.Add(Crawler);
+
+	// Pick up where it left off if it had been detached, e.g. by a level going away and coming back.
+	if (Crawler->DetachedHot)
+	{
+		HotStates.Add(*Crawler->DetachedHot);
+		Crawler->DetachedHot.Reset();
+	}
+	else
+	{
+		HotStates.AddDefaulted();
+	}
+}
+
+void UCrawlieSwarmSubsystem::ReleaseHotState(APhyCrawlie* Crawler)
+{
+	const int32 Handle = Crawler->HotHandle;
+	DetachHotState(*Crawler);
+
+	if (bFrameInFlight)
+	{
+		Crawlers[Handle] = nullptr;
+		HotStates[Handle].Flags = ECrawlieFlags::None;
+		bNeedsCompact = true;
+		return;
+	}
+
+	Crawlers.RemoveAtSwap(Handle);
+	HotStates.RemoveAtSwap(Handle);
+	if (Crawlers.IsValidIndex(Handle) && Crawlers[Handle])
+	{
+		Crawlers[Handle]->HotHandle = Handle;
+	}
+}
+
+void UCrawlieSwarmSubsystem::DetachHotState(APhyCrawlie& Crawler)
+{
+	Crawler.DetachedHot = MakeUnique<FCrawlieHotState>(HotStates[Crawler.HotHandle]);
+	Crawler.DetachedHot->Set(ECrawlieFlags::SwarmTicked, false);
+	Crawler.Swarm = nullptr;
+	Crawler.HotHandle = INDEX_NONE;
+}
+
+void UCrawlieSwarmSubsystem::CompactHotStates()
+{
+	// Keeps the order, so crawlers stay in the groups they were in.
+	int32 NumLive = 0;
+	for (int32 Handle = 0; Handle < Crawlers.Num(); ++Handle)
+	{
+		APhyCrawlie* Crawler = Crawlers[Handle];
+		if (!Crawler)
+		{
+			continue;
+		}
+
+		if (Handle != NumLive)
+		{
+			Crawlers[NumLive] = Crawler;
+			HotStates[NumLive] = HotStates[Handle];
+			Crawler->HotHandle = NumLive;
+		}
+		++NumLive;
+	}
+
+	Crawlers.SetNum(NumLive);
+	HotStates.SetNum(NumLive);
+	bNeedsCompact = false;
+}
+
+void UCrawlieSwarmSubsystem::TakeOverTick(APhyCrawlie* Crawler)
+{
+	// Switching the actor tick off would silently drop a Blueprint's Event Tick. Those crawlers keep
+	// ticking themselves, whole, and the phases skip them.
+	if (Crawler->HasBlueprintTick())
+	{
+		return;
+	}
+
+	HotStates[Crawler->HotHandle].Set(ECrawlieFlags::SwarmTicked, true);
+	Crawler->SetActorTickEnabled(false);
+
+	// The mesh poses from the committed transform, so it waits for Commit. That puts it in DuringPhysics,
+	// which a prerequisite alone would do without saying; set the group so it's visible on the mesh.
+	// A mesh simulating physics has to tick before the step to hand its bodies over, so it keeps its
+	// group and poses from last frame's transform instead.
+	USkeletalMeshComponent* Mesh = Crawler->SkeletalMesh;
+	if (Mesh && !Mesh->IsAnySimulatingPhysics())
+	{
+		Mesh->SetTickGroup(TG_DuringPhysics);
+		Mesh->PrimaryComponentTick.AddPrerequisite(this, PhaseTicks[int32(ECrawliePhase::Commit)]);
+	}
+}
+
+void UCrawlieSwarmSubsystem::TickPhase(ECrawliePhase Phase, float DeltaTime)
+{
+	switch (Phase)
+	{
+	case ECrawliePhase::Integrate:
+	{
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieSwarmIntegrate);
+		bFrameInFlight = true;
+		NumFrameSlots = HotStates.Num();
+		for (int32 Handle = 0; Handle < NumFrameSlots; ++Handle)
+		{
+			FCrawlieHotState& Hot = HotStates[Handle];
+			if (!Hot.Has(ECrawlieFlags::SwarmTicked))
+			{
+				continue;
+			}
+
+			// Walking only needs the hot state. Transitions and the replay recorder need the actor.
+			if (Hot.Has(ECrawlieFlags::GoingUp | ECrawlieFlags::GoingDown | ECrawlieFlags::Recording))
+			{
+				Crawlers[Handle]->Integrate(DeltaTime);
+				continue;
+			}
+
+			APhyCrawlie::IntegrateWalking(Hot, DeltaTime);
+		}
+		break;
+	}
+
+	case ECrawliePhase::Sense:
+	{
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieSwarmSense);
+		ForEachGroup([](APhyCrawlie& Crawler, FCrawlieHotState& Hot)
+		{
+			if (!Hot.Has(ECrawlieFlags::GoingUp | ECrawlieFlags::GoingDown))
+			{
+				Crawler.Sense();
+			}
+		});
+		break;
+	}
+
+	case ECrawliePhase::Decide:
+	{
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieSwarmDecide);
+		ForEachGroup([DeltaTime](APhyCrawlie& Crawler, FCrawlieHotState& Hot)
+		{
+			if (Hot.TickTurnRateTimer(DeltaTime))
+			{
+				Crawler.ChangeTurnRate();
+			}
+		});
+		break;
+	}
+
+	case ECrawliePhase::Commit:
+	{
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieSwarmCommit);
+		for (int32 Handle = 0; Handle < NumFrameSlots; ++Handle)
+		{
+			if (HotStates[Handle].Has(ECrawlieFlags::SwarmTicked))
+			{
+				Crawlers[Handle]->CommitTransform(DeltaTime);
+			}
+		}
+
+		bFrameInFlight = false;
+		if (bNeedsCompact)
+		{
+			CompactHotStates();
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+void UCrawlieSwarmSubsystem::ForEachGroup(TFunctionRef<void(APhyCrawlie&, FCrawlieHotState&)> Function)
+{
+	const int32 GroupSize = FMath::Max(CVarCrawlieGroupSize.GetValueOnAnyThread(), 1);
+	const int32 NumGroups = FMath::DivideAndRoundUp(NumFrameSlots, GroupSize);
+
+	// Each crawler only touches its own state, so groups don't need to synchronize. Called from the
+	// game thread, which waits here, see OnWorldBeginPlay.
+	ParallelFor(NumGroups, [this, GroupSize, Function](int32 Group)
+	{
+		const int32 End = FMath::Min((Group + 1) * GroupSize, NumFrameSlots);
+		for (int32 Handle = Group * GroupSize; Handle < End; ++Handle)
+		{
+			FCrawlieHotState& Hot = HotStates[Handle];
+			if (Hot.Has(ECrawlieFlags::SwarmTicked))
+			{
+				Function(*Crawlers[Handle], Hot);
+			}
+		}
+	}, bParallelSense ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+}
+
+void UCrawlieSwarmSubsystem::OnPreLevelRemoved(ULevel* Level, UWorld* World)
+{
+	// A null level means the whole world is going away, nothing to come back to.
+	if (Level && World == GetWorld())
+	{
+		Hibernate(Level);
+	}
+}
+
+void UCrawlieSwarmSubsystem::OnLevelAdded(ULevel* Level, UWorld* World)
+{
+	if (Level && World == GetWorld())
+	{
+		Restore(Level);
+	}
+}
+
+void UCrawlieSwarmSubsystem::Hibernate(ULevel* Level)
+{
+	TArray<APhyCrawlie*> Sleepers;
+	for (APhyCrawlie* Crawler : Crawlers)
+	{
+		// Crawlers placed in the level itself unload and reload with it.
+		if (!IsValid(Crawler) || Crawler->GetLevel() == Level)
+		{
+			continue;
+		}
+
+		const UPrimitiveComponent* Surface = Crawler->GetSurface();
+		if (Surface && Surface->GetComponentLevel() == Level)
+		{
+			Sleepers.Add(Crawler);
+		}
+	}
+
+	if (Sleepers.IsEmpty())
+	{
+		return;
+	}
+
+	FCrawlieDormantLevel& Dormant = DormantLevels.FindOrAdd(Level->GetOutermost()->GetFName());
+	Dormant.Records.Reserve(Dormant.Records.Num() + Sleepers.Num());
+	for (APhyCrawlie* Crawler : Sleepers)
+	{
+		Crawler->WriteDormantRecord(Dormant.Records.AddDefaulted_GetRef());
+		Crawler->Destroy();
+	}
+
+	NumDormantRecords += Sleepers.Num();
+	INC_DWORD_STAT_BY(STAT_CrawliesDormant, Sleepers.Num());
+	UE_LOG(LogCrawlie, Log, TEXT("Hibernated %d crawlers with %s"), Sleepers.Num(), *Level->GetOutermost()->GetName());
+}
+
+void UCrawlieSwarmSubsystem::Restore(ULevel* Level)
+{
+	FCrawlieDormantLevel Dormant;
+	if (!DormantLevels.RemoveAndCopyValue(Level->GetOutermost()->GetFName(), Dormant))
+	{
+		return;
+	}
+
+	NumDormantRecords -= Dormant.Records.Num();
+	DEC_DWORD_STAT_BY(STAT_CrawliesDormant, Dormant.Records.Num());
+
+	int32 NumRestored = 0;
+	for (const FCrawlieDormantRecord& Record : Dormant.Records)
+	{
+		AActor* SurfaceActor = FindObjectFast<AActor>(Level, Record.SurfaceActor);
+		UPrimitiveComponent* Surface = SurfaceActor ? FindObjectFast<UPrimitiveComponent>(SurfaceActor, Record.SurfaceComponent) : nullptr;
+		if (!Surface || !Record.Class)
+		{
+			continue;
+		}
+
+		const FTransform& SurfaceTransform = Surface->GetComponentTransform();
+		const FTransform SpawnTransform(
+			SurfaceTransform.GetRotation() * FQuat(Record.LocalRotation),
+			SurfaceTransform.TransformPosition(FVector(Record.LocalLocation)));
+
+		APhyCrawlie* Crawler = GetWorld()->SpawnActorDeferred<APhyCrawlie>(Record.Class, SpawnTransform, nullptr, nullptr,
+			ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+		if (Crawler)
+		{
+			Crawler->RestoreFromDormantRecord(Record, Surface);
+			Crawler->FinishSpawning(SpawnTransform);
+			++NumRestored;
+		}
+	}
+
+	UE_LOG(LogCrawlie, Log, TEXT("Restored %d of %d crawlers with %s"), NumRestored, Dormant.Records.Num(), *Level->GetOutermost()->GetName());
+}
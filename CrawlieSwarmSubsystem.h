@@ -0,0 +1,139 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineBaseTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "CrawlieState.h"
+#include "CrawlieSwarmSubsystem.generated.h"
+
+class APhyCrawlie;
+class UCrawlieProfile;
+class UCrawlieSwarmSubsystem;
+
+// Phases of a swarm tick, in order. Each runs over every crawler before the next one starts.
+// The crawlers' skeletal meshes animate after Commit, moved to DuringPhysics with a prerequisite on it,
+// unless they simulate physics.
+enum class ECrawliePhase : uint8
+{
+	Integrate,	// Timers and movement. PrePhysics.
+	Sense,		// Probes and the transitions they start. DuringPhysics, optionally spread over worker threads.
+	Decide,		// Turn rate for the next step. Runs where Sense does.
+	Commit,		// Transform writes. Game thread.
+	Num,
+};
+
+USTRUCT()
+struct FCrawliePhaseTickFunction : public FTickFunction
+{
+	GENERATED_BODY()
+
+	UCrawlieSwarmSubsystem* Swarm = nullptr;
+	ECrawliePhase Phase = ECrawliePhase::Integrate;
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override;
+	virtual FName DiagnosticContext(bool bDetailed) override;
+};
+
+template<>
+struct TStructOpsTypeTraits<FCrawliePhaseTickFunction> : public TStructOpsTypeTraitsBase2<FCrawliePhaseTickFunction>
+{
+	enum { WithCopy = false };
+};
+
+// A crawler put to sleep because the level holding its surface streamed out.
+// Location and rotation are relative to the surface component, so the crawler comes back where it left.
+USTRUCT()
+struct FCrawlieDormantRecord
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TSubclassOf<APhyCrawlie> Class;
+	UPROPERTY()
+	UCrawlieProfile* Profile = nullptr;
+
+	FName SurfaceActor;
+	FName SurfaceComponent;
+	FVector3f LocalLocation = FVector3f::ZeroVector;
+	FQuat4f LocalRotation = FQuat4f::Identity;
+	int32 RandomSeed = 0;
+	float TimeUntilTurnRateChange = 0;
+	float ForwardSpeed = 0;
+	int16 TurnRateInDegrees = 0;
+};
+
+USTRUCT()
+struct FCrawlieDormantLevel
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TArray<FCrawlieDormantRecord> Records;
+};
+
+// Keeps track of the crawlers in a world, ticks them in phases (see ECrawliePhase), and hibernates
+// the ones standing on geometry in a streaming level (or world partition cell) while that level is unloaded.
+UCLASS()
+class PHY_API UCrawlieSwarmSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+
+	void Register(APhyCrawlie* Crawler);
+	void Unregister(APhyCrawlie* Crawler);
+
+	// Every crawler in the world keeps its hot state here, at its handle. Handles don't move while a
+	// frame is in flight; slots given up mid-frame are compacted after Commit, which renumbers them.
+	void AcquireHotState(APhyCrawlie* Crawler);
+	void ReleaseHotState(APhyCrawlie* Crawler);
+	FCrawlieHotState& GetHotState(int32 Handle) { return HotStates[Handle]; }
+	const FCrawlieHotState& GetHotState(int32 Handle) const { return HotStates[Handle]; }
+
+	int32 NumActive() const { return Crawlers.Num(); }
+	int32 NumDormant() const { return NumDormantRecords; }
+
+	void TickPhase(ECrawliePhase Phase, float DeltaTime);
+
+private:
+	void OnPreLevelRemoved(ULevel* Level, UWorld* World);
+	void OnLevelAdded(ULevel* Level, UWorld* World);
+	void Hibernate(ULevel* Level);
+	void Restore(ULevel* Level);
+	void TakeOverTick(APhyCrawlie* Crawler);
+	// Hands the crawler a copy of its hot state to keep on the actor, leaving the slot behind.
+	void DetachHotState(APhyCrawlie& Crawler);
+	void CompactHotStates();
+	// Runs Function on every swarm-ticked crawler of this frame, in groups spread over worker threads
+	// when parallel sense is on.
+	void ForEachGroup(TFunctionRef<void(APhyCrawlie&, FCrawlieHotState&)> Function);
+
+	// Parallel arrays indexed by hot handle. A slot released mid-frame holds null until compacted.
+	// The default heap allocator only guarantees 16 byte alignment, which would split most slots
+	// across two cache lines.
+	UPROPERTY()
+	TArray<APhyCrawlie*> Crawlers;
+	TArray<FCrawlieHotState, TAlignedHeapAllocator<alignof(FCrawlieHotState)>> HotStates;
+
+	// Keyed by the package name of the unloaded level, which is stable across reloads.
+	UPROPERTY()
+	TMap<FName, FCrawlieDormantLevel> DormantLevels;
+
+	int32 NumDormantRecords = 0;
+
+	FCrawliePhaseTickFunction PhaseTicks[int32(ECrawliePhase::Num)];
+	bool bGroupTick = false;
+	bool bParallelSense = false;
+	// Slots that existed at this frame's Integrate. Crawlers spawned later in the frame start next frame.
+	int32 NumFrameSlots = 0;
+	bool bFrameInFlight = false;
+	bool bNeedsCompact = false;
+
+	FDelegateHandle PreLevelRemovedHandle;
+	FDelegateHandle LevelAddedHandle;
+};
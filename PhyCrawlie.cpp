@@ -2,6 +2,9 @@
 
 #include "PhyCrawlie.h"
 #include <algorithm>
+#include "CrawlieProfile.h"
+#include "CrawlieStats.h"
+#include "CrawlieSwarmSubsystem.h"
 #include "Components/SkeletalMeshComponent.h"
 #include "Components/SphereComponent.h"
 #include "Kismet/KismetMathLibrary.h"
@@ -14,158 +17,245 @@ APhyCrawlie::APhyCrawlie()
 
 	Root = CreateDefaultSubobject<USphereComponent>(TEXT("Root"));
 	RootComponent = Root;
-	Root->SetSphereRadius(ColliderRadius);
 	Root->SetCollisionEnabled(ECollisionEnabled::NoCollision);
 
 	SkeletalMesh = CreateDefaultSubobject<USkeletalMeshComponent>(TEXT("SkeletalMesh"));
 	SkeletalMesh->SetupAttachment(RootComponent);
+	SkeletalMesh->SetGenerateOverlapEvents(false);
+}
+
+void APhyCrawlie::PostInitializeComponents()
+{
+	Super::PostInitializeComponents();
+	AcquireHotState();
+	ApplyProfile();
 }
 
 void APhyCrawlie::BeginPlay()
 {
 	Super::BeginPlay();
 
-	ForwardSpeed = 50;
-	TargetTransform = GetActorTransform();
-	
-	AddActorLocalRotation(FRotator(0, FMath::RandRange(0, 359), 0));
+	// A crawler whose level was removed and added back gave up its slot in EndPlay.
+	AcquireHotState();
+	if (Swarm)
+	{
+		Swarm->Register(this);
+	}
+
+	FCrawlieHotState& Hot = GetHot();
+	Hot.ResetSurfaceFrame(GetActorLocation(), FQuat4f(GetActorQuat()));
+	Transition.To = Hot.GetPose();
+	Recorder = FCrawlieReplayRecorder::CreateIfEnabled(bRecordReplay);
+	Hot.Set(ECrawlieFlags::Recording, Recorder.IsValid());
+	if (Hot.Has(ECrawlieFlags::Restored)) return;
+
+	Hot.ForwardSpeed = GetProfile().ForwardSpeed;
+	RandomStream.Initialize(FMath::Rand());
+	Hot.Heading = FMath::DegreesToRadians(float(RandomStream.RandRange(0, 359)));
+	SetActorRotation(GetCrawlieQuat());
 	SetNextTimeOfChangeInTurnRate();
 }
 
+void APhyCrawlie::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (Recorder)
+	{
+		SaveReplay();
+	}
+
+	if (Swarm)
+	{
+		Swarm->Unregister(this);
+		Swarm->ReleaseHotState(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void APhyCrawlie::BeginDestroy()
+{
+	// Destroyed without ending play, e.g. a restored crawler that never finished spawning.
+	if (Swarm)
+	{
+		Swarm->ReleaseHotState(this);
+	}
+
+	Super::BeginDestroy();
+}
+
+void APhyCrawlie::AcquireHotState()
+{
+	if (Swarm)
+	{
+		return;
+	}
+
+	const UWorld* World = GetWorld();
+	if (UCrawlieSwarmSubsystem* WorldSwarm = World ? World->GetSubsystem<UCrawlieSwarmSubsystem>() : nullptr)
+	{
+		WorldSwarm->AcquireHotState(this);
+	}
+	else if (!DetachedHot)
+	{
+		DetachedHot = MakeUnique<FCrawlieHotState>();
+	}
+}
+
 
 
 void APhyCrawlie::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
-	
-	DTime = DeltaTime;
-	
-	if (GetGameTimeSinceCreation() > TimeOfNextTurnRateChange)
+	TickCrawler(DeltaTime);
+}
+
+bool APhyCrawlie::HasBlueprintTick() const
+{
+	return GetClass()->IsFunctionImplementedInScript(GET_FUNCTION_NAME_CHECKED(APhyCrawlie, ReceiveTick));
+}
+
+void APhyCrawlie::TickCrawler(float DeltaTime)
+{
+	CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTick);
+
+	Integrate(DeltaTime);
+	Sense();
+	Decide(DeltaTime);
+
+	// Playback only exercises the decision code.
+	if (!ReplayPlayer) CommitTransform(DeltaTime);
+}
+
+void APhyCrawlie::Integrate(float DeltaTime)
+{
+	if (Recorder) Recorder->BeginFrame(CaptureReplayState(), DeltaTime);
+	FCrawlieHotState& Hot = GetHot();
+	if (!Hot.Has(ECrawlieFlags::GoingDown | ECrawlieFlags::GoingUp))
 	{
-		UpdateTurnRate();
-		SetNextTimeOfChangeInTurnRate();	
+		IntegrateWalking(Hot, DeltaTime);
+		return;
 	}
-	
-	if (bIsGoingDown || bIsGoingUp)
+
+	Hot.Set(ECrawlieFlags::WithoutFloor, false);
+
+	// The stat macros expand to blocks, so each branch needs its own braces.
+	if (Hot.Has(ECrawlieFlags::GoingUp))
 	{
-		GoToNewSurface();
-		return;
+		INC_DWORD_STAT(STAT_CrawliesGoingUp);
+	}
+	else
+	{
+		INC_DWORD_STAT(STAT_CrawliesGoingDown);
 	}
 
+	GoToNewSurface(DeltaTime);
+}
 
-	Move();
+void APhyCrawlie::IntegrateWalking(FCrawlieHotState& Hot, float DeltaTime)
+{
+	CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieMove);
+	INC_DWORD_STAT(STAT_CrawliesWalking);
+	Hot.Set(ECrawlieFlags::WithoutFloor, false);
+	Hot.Move(DeltaTime);
+}
 
-	TraceForBarrier();
-	if (bIsSwitchingSurface) return;
+void APhyCrawlie::Sense()
+{
+	// Mid transition there is no surface to probe.
+	if (GetHot().Has(ECrawlieFlags::GoingDown | ECrawlieFlags::GoingUp)) return;
 
+	TraceForBarrier();
 	TraceAhead();
-	if (bIsSwitchingSurface) return;
-	
 	TraceFloor();
 }
 
-void APhyCrawlie::GoToNewSurface()
+void APhyCrawlie::Decide(float DeltaTime)
+{
+	if (GetHot().TickTurnRateTimer(DeltaTime))
+	{
+		ChangeTurnRate();
+	}
+}
+
+void APhyCrawlie::ChangeTurnRate()
 {
-	UE_LOG(LogTemp, Warning, TEXT("Going to new surface"));
-	SetActorLocation(FMath::Lerp(OldTransform.GetLocation(), TargetTransform.GetLocation(), LerpValue));
-	SetActorRotation(FQuat::Slerp(OldTransform.GetRotation(), TargetTransform.Rotator().Quaternion(), LerpValue));
+	UpdateTurnRate();
+	SetNextTimeOfChangeInTurnRate();
+}
 
-	if (LerpValue != 1)
+void APhyCrawlie::GoToNewSurface(float DeltaTime)
+{
+	CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieGoToNewSurface);
+	FCrawlieHotState& Hot = GetHot();
+	UE_LOG(LogCrawlie, Warning, TEXT("Going to new surface"));
+	Hot.ResetSurfaceFrame(
+		FMath::Lerp(Transition.From.Location, Transition.To.Location, Transition.LerpValue),
+		FQuat4f::Slerp(Transition.From.Rotation, Transition.To.Rotation, Transition.LerpValue));
+
+	if (Transition.LerpValue != 1)
 	{
-		float LerpSpeed = ForwardSpeed * 0.3f;
-		float Distance = TargetTransform.GetLocation().Size() - OldTransform.GetLocation().Size();
+		float LerpSpeed = Hot.ForwardSpeed * Probes->TransitionSpeed;
+		float Distance = float(Transition.To.Location.Size() - Transition.From.Location.Size());
 		Distance = FMath::Abs(Distance);
-		UE_LOG(LogTemp, Warning, TEXT("Distance: %f"), Distance);
-		LerpValue += DTime / Distance * LerpSpeed;
-		if (LerpValue > 1) LerpValue = 1;
-		if (bIsGoingDown)
+		UE_LOG(LogCrawlie, Warning, TEXT("Distance: %f"), Distance);
+		Transition.LerpValue += DeltaTime / Distance * LerpSpeed;
+		if (Transition.LerpValue > 1) Transition.LerpValue = 1;
+		if (Hot.Has(ECrawlieFlags::GoingDown))
 		{
-			UE_LOG(LogTemp, Warning, TEXT("Abort going down"));
+			UE_LOG(LogCrawlie, Warning, TEXT("Abort going down"));
 			TraceAhead();
 		}
 		return;
 	}
 
-	LerpValue = 0;
-	bIsGoingUp = false;
-	bIsGoingDown = false;
+	Transition.LerpValue = 0;
+	Hot.Set(ECrawlieFlags::GoingUp, false);
+	Hot.Set(ECrawlieFlags::GoingDown, false);
 }
 
 void APhyCrawlie::TraceAhead()
 {
+	FCrawlieHotState& Hot = GetHot();
 	ECollisionChannel Channel = ECC_WorldStatic;
-	float Radius = ColliderRadius;
-	float TraceWidth = 1.0f * ColliderRadius;
-	float TraceHeight = 1.6f * ColliderRadius;
-	FVector LocationVector = GetActorLocation();	
-	FVector TraceDistance = GetActorForwardVector() * ColliderRadius * 1.5f;
-	FVector ForwardOffset = GetActorForwardVector() * ColliderRadius * 0.5f;
-	FVector LowerOffset = GetActorUpVector() * -TraceHeight / 2;
-	FVector UpperOffset = GetActorUpVector() * TraceHeight / 2;
-	FVector RightOffset = GetActorRightVector() * TraceWidth / 2;
-	FVector LeftOffset = GetActorRightVector() * -TraceWidth / 2;
+	const FTransform Frame = GetCrawlieFrame();
+
+	auto TraceTier = [this, &Hot, &Frame, Channel](FCrawlieProbeTable::ETier Tier, const TCHAR* TierName)
+	{
+		FHitResult HitResultRight;
+		FHitResult HitResultLeft;
+		TraceProbe(HitResultRight, Probes->Ahead[Tier][FCrawlieProbeTable::Right], Frame, Channel);
+		TraceProbe(HitResultLeft, Probes->Ahead[Tier][FCrawlieProbeTable::Left], Frame, Channel);
+		if (!HitResultLeft.bBlockingHit || !HitResultRight.bBlockingHit)
+		{
+			return false;
+		}
+
+		SetTransforms(&HitResultRight, &HitResultLeft, Probes->AheadWidth);
+		Hot.Set(ECrawlieFlags::GoingUp, true);
+		Hot.Set(ECrawlieFlags::GoingDown, false);
+		INC_DWORD_STAT(STAT_CrawlieTransitionsStarted);
+		UE_LOG(LogCrawlie, Warning, TEXT("Obstacle %s, going up"), TierName);
+		return true;
+	};
 
-	
 	// Trace low. So I don't kick a toe.
-	FVector StartLowRight = LocationVector + ForwardOffset + LowerOffset + RightOffset;
-	FVector EndLowRight = StartLowRight + TraceDistance;
-	FVector StartLowLeft = LocationVector + ForwardOffset + LowerOffset + LeftOffset;
-	FVector EndLowLeft = StartLowLeft + TraceDistance;
-	FHitResult HitResultLowRight;
-	FHitResult HitResultLowLeft;
-	GetWorld()->LineTraceSingleByChannel(HitResultLowRight, StartLowRight, EndLowRight, Channel);
-	GetWorld()->LineTraceSingleByChannel(HitResultLowLeft, StartLowLeft, EndLowLeft, Channel);
-
-	if (HitResultLowLeft.bBlockingHit && HitResultLowRight.bBlockingHit)
 	{
-		SetTransforms(&HitResultLowRight, &HitResultLowLeft, TraceWidth);
-		bIsGoingUp = true;
-		bIsGoingDown = false;
-		UE_LOG(LogTemp, Warning, TEXT("Obstacle LOW, going up"));
-		return;
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTraceAheadLow);
+		if (TraceTier(FCrawlieProbeTable::Low, TEXT("LOW"))) return;
 	}
 
-	
 	// Nothing down low. Check at actor center elevation
-	FVector StartMidRight = LocationVector + ForwardOffset + RightOffset;
-	FVector EndMidRight = StartMidRight + TraceDistance;
-	FVector StartMidLeft = LocationVector + ForwardOffset + LeftOffset;
-	FVector EndMidLeft = StartMidLeft + TraceDistance;
-	FHitResult HitResultMidRight;
-	FHitResult HitResultMidLeft;
-	GetWorld()->LineTraceSingleByChannel(HitResultMidRight, StartMidRight, EndMidRight, Channel);
-	GetWorld()->LineTraceSingleByChannel(HitResultMidLeft, StartMidLeft, EndMidLeft, Channel);
-
-	if (HitResultMidLeft.bBlockingHit && HitResultMidRight.bBlockingHit)
 	{
-		SetTransforms(&HitResultMidRight, &HitResultMidLeft, TraceWidth);
-		bIsGoingUp = true;
-		bIsGoingDown = false;
-		UE_LOG(LogTemp, Warning, TEXT("Obstacle MID, going up"));
-
-		return;
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTraceAheadMid);
+		if (TraceTier(FCrawlieProbeTable::Mid, TEXT("MID"))) return;
 	}
 
-	
 	// Nothing at center elevation either. Check higher so as not to bump my head.
-	FVector StartHighRight = LocationVector + ForwardOffset + UpperOffset + RightOffset;
-	FVector EndHighRight = StartHighRight + TraceDistance;
-	FVector StartHighLeft = LocationVector + ForwardOffset + UpperOffset + LeftOffset;
-	FVector EndHighLeft = StartHighLeft + TraceDistance;
-	FHitResult HitResultHighRight;
-	FHitResult HitResultHighLeft;
-	GetWorld()->LineTraceSingleByChannel(HitResultHighRight, StartHighRight, EndHighRight, Channel);
-	GetWorld()->LineTraceSingleByChannel(HitResultHighLeft, StartHighLeft, EndHighLeft, Channel);
-
-	if (HitResultHighLeft.bBlockingHit && HitResultHighRight.bBlockingHit)
 	{
-		SetTransforms(&HitResultHighRight, &HitResultHighLeft, TraceWidth);
-		bIsGoingUp = true;
-		bIsGoingDown = false;
-		UE_LOG(LogTemp, Warning, TEXT("Obstacle HIGH, going up"));
-
-		return;
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTraceAheadHigh);
+		if (TraceTier(FCrawlieProbeTable::High, TEXT("HIGH"))) return;
 	}
+
 	////////////////////////////////////////////////////////////////////////////////////////////////
 
 	//
@@ -229,188 +319,185 @@ void APhyCrawlie::SetTransforms(FHitResult* HitResultR, FHitResult* HitResultL,
 	FVector CenterPoint = (HitResultR->Location + HitResultL->Location) / 2;
 	
 	FVector NewUp = HitResultR->Normal;
-	FVector NewRight = FVector::CrossProduct(HitResultR->Normal, GetActorUpVector());
+	FVector NewRight = FVector::CrossProduct(HitResultR->Normal, GetCrawlieUpVector());
 	NewRight = NewRight.RotateAngleAxis(Angle * (180/PI), NewUp);
 	FVector NewForward = FVector::CrossProduct(NewRight, NewUp);
 	FRotator NewRotator = UKismetMathLibrary::MakeRotationFromAxes(NewForward, NewRight, NewUp);
-	FVector NewLocation = CenterPoint + NewForward * ColliderRadius + HitResultR->Normal * ColliderRadius;
+	FVector NewLocation = CenterPoint + (NewForward + HitResultR->Normal) * Probes->ColliderRadius;
 		
-	TargetTransform.SetRotation(NewRotator.Quaternion());
-	TargetTransform.SetLocation(NewLocation);
-	OldTransform.SetRotation(GetActorRotation().Quaternion());
-	OldTransform.SetLocation(GetActorLocation());
+	Transition.To.Rotation = FQuat4f(NewRotator.Quaternion());
+	Transition.To.Location = NewLocation;
+	Transition.From = GetHot().GetPose();
 }
 
 
 void APhyCrawlie::TraceForBarrier()
 {
-	FVector Start = GetActorLocation();
-	FVector End = GetActorLocation() + GetActorForwardVector() * ColliderRadius * 3;
+	CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTraceForBarrier);
+	FCrawlieHotState& Hot = GetHot();
 	FHitResult HitResult;
 	ECollisionChannel CrawlieBarrierChannel = ECollisionChannel::ECC_GameTraceChannel2;
 
-	GetWorld()->LineTraceSingleByChannel(HitResult, Start, End, CrawlieBarrierChannel);
+	TraceProbe(HitResult, Probes->Barrier, GetCrawlieFrame(), CrawlieBarrierChannel);
 	if (HitResult.bBlockingHit)
 	{
 		// UE_LOG(LogTemp, Warning, TEXT("Barrier, turn around"))
-		OldTransform.SetLocation(GetActorLocation());
-		OldTransform.SetRotation(GetActorRotation().Quaternion());
-		FRotator NewRotation = GetActorRotation() + FRotator(180, 0, 0);
-		TargetTransform.SetRotation(NewRotation.Quaternion());
-		TargetTransform.SetLocation(GetActorLocation() + GetActorForwardVector() * -ColliderRadius);
+		Transition.From = Hot.GetPose();
+		FRotator NewRotation = GetCrawlieQuat().Rotator() + FRotator(180, 0, 0);
+		Transition.To.Rotation = FQuat4f(NewRotation.Quaternion());
+		Transition.To.Location = GetCrawlieLocation() + GetCrawlieForwardVector() * -Probes->ColliderRadius;
 
-		bIsGoingUp = true;
+		Hot.Set(ECrawlieFlags::GoingUp, true);
+		INC_DWORD_STAT(STAT_CrawlieTransitionsStarted);
 	}
 }
 
 void APhyCrawlie::TraceFloor()
 {
+	FCrawlieHotState& Hot = GetHot();
 	ECollisionChannel Channel = ECC_WorldStatic;
+	const FTransform Frame = GetCrawlieFrame();
+	const float Radius = Probes->ColliderRadius;
 
 	// Trace below center of actor
-	FVector Start = GetActorLocation() + GetActorUpVector() * ColliderRadius * -0.9f;
-	FVector End = Start + GetActorUpVector() * ColliderRadius * -0.2f;
-	FHitResult HitResult;
-	GetWorld()->LineTraceSingleByChannel(HitResult, Start, End, Channel);
+	{
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTraceFloorCenter);
+		FHitResult HitResult;
+		TraceProbe(HitResult, Probes->FloorCenter, Frame, Channel);
 
-	if (HitResult.bBlockingHit)
+		if (HitResult.bBlockingHit)
+		{
+			if (Surface != HitResult.GetComponent()) Surface = HitResult.GetComponent();
+
+			// Fine tune distance to floor
+			float DistanceToFloor = HitResult.Distance + Probes->FloorProbeOffset;
+			// AddActorLocalOffset(FVector(0, 0, DistanceToFloor - ColliderRadius));
+			// UE_LOG(LogTemp, Warning, TEXT("Elevation adjusted with %f"), DistanceToFloor - ColliderRadius);
+			// GEngine->AddOnScreenDebugMessage(1, 3.f, FColor::Red,
+			// 	FString::Printf(TEXT("Distance to floor adjusted by %f"), DistanceToFloor - ColliderRadius));
+			return;
+		}
+	}
+
+	if (Probes->FloorProbeMode == ECrawlieFloorProbeMode::Classify)
 	{
-		// Fine tune distance to floor
-		float DistanceToFloor = HitResult.Distance + ColliderRadius * 0.9f;
-		// AddActorLocalOffset(FVector(0, 0, DistanceToFloor - ColliderRadius));
-		// UE_LOG(LogTemp, Warning, TEXT("Elevation adjusted with %f"), DistanceToFloor - ColliderRadius);
-		// GEngine->AddOnScreenDebugMessage(1, 3.f, FColor::Red,
-		// 	FString::Printf(TEXT("Distance to floor adjusted by %f"), DistanceToFloor - ColliderRadius));
+		ClassifyFloor(Frame);
 		return;
 	}
 
-
 	// Substep tracing below front half of collider.
 	// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
 	// 	FString::Printf(TEXT("Not grounded. Checking a little further ahead.")));
-	int Steps = 6;
-
-	FHitResult HitResultSubstep;
-	for (int i = 0; i < Steps; ++i)
 	{
-		FVector StartSubstep = GetActorLocation() +
-			GetActorUpVector() * (ColliderRadius * -0.9f) +
-			GetActorForwardVector() * (ColliderRadius * i / (Steps - 1));
-		FVector EndSubstep = StartSubstep + GetActorUpVector() * (ColliderRadius * -0.2f);
-		GetWorld()->LineTraceSingleByChannel(HitResultSubstep, StartSubstep, EndSubstep, Channel);
-		// DrawDebugLine(GetWorld(), StartSubstep, EndSubstep, HitResultSubstep.bBlockingHit? FColor::Green : FColor::Red);
-		if (HitResultSubstep.bBlockingHit)
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTraceFloorSubsteps);
+		FHitResult HitResultSubstep;
+		for (const FCrawlieProbe& Substep : Probes->FloorSubsteps)
 		{
-			// Found something close enough. Just keep going.
-			UE_LOG(LogTemp, Warning, TEXT("Floor seems uneven, but ok"));
-			// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
-			// 	FString::Printf(TEXT("Found floor a little ahead")));
-			return;
+			TraceProbe(HitResultSubstep, Substep, Frame, Channel);
+			// DrawDebugLine(GetWorld(), StartSubstep, EndSubstep, HitResultSubstep.bBlockingHit? FColor::Green : FColor::Red);
+			if (HitResultSubstep.bBlockingHit)
+			{
+				// Found something close enough. Just keep going.
+				UE_LOG(LogCrawlie, Warning, TEXT("Floor seems uneven, but ok"));
+				// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
+				// 	FString::Printf(TEXT("Found floor a little ahead")));
+				return;
+			}
 		}
 	}
-	
+
 
 	// Trace for lower ground
 	// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
 	// 	FString::Printf(TEXT("Not grounded. Checking deeper.")));
 	
-	FVector Start2 = GetActorLocation() +
-					GetActorUpVector() * -ColliderRadius;
-	FVector End2 = Start2 +
-					GetActorUpVector() * ColliderRadius * -1 +
-					GetActorForwardVector() * ColliderRadius * -2;
-	FHitResult HitResult2;
-	GetWorld()->LineTraceSingleByChannel(HitResult2, Start2, End2, Channel);
-
-	if (HitResult2.bBlockingHit)
 	{
-		// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
-		// 	FString::Printf(TEXT("Found new lower floor")));
-
-		// Get angle of edge data
-		FVector StartRight = Start2 + GetActorRightVector() * 0.2f;
-		FVector EndRight = End2 + GetActorRightVector() * 0.2f;
-		FVector StartLeft = Start2 + GetActorRightVector() * -0.2f;
-		FVector EndLeft = End2 + GetActorRightVector() * -0.2f;
-		FHitResult HitResultRight;
-		FHitResult HitResultLeft;
-		GetWorld()->LineTraceSingleByChannel(HitResultRight, StartRight, EndRight, Channel);
-		GetWorld()->LineTraceSingleByChannel(HitResultLeft, StartLeft, EndLeft, Channel);
-		float Diff = HitResultRight.Distance - HitResultLeft.Distance;
-		float Width = 0.4f;
-		float Angle = UKismetMathLibrary::Atan(Diff / Width);
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTraceFloorLower);
+		FHitResult HitResult2;
+		TraceProbe(HitResult2, Probes->Lower, Frame, Channel);
+
+		if (HitResult2.bBlockingHit)
+		{
+			// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
+			// 	FString::Printf(TEXT("Found new lower floor")));
+
+			// Get angle of edge data
+			FHitResult HitResultRight;
+			FHitResult HitResultLeft;
+			TraceProbe(HitResultRight, Probes->LowerEdge[FCrawlieProbeTable::Right], Frame, Channel);
+			TraceProbe(HitResultLeft, Probes->LowerEdge[FCrawlieProbeTable::Left], Frame, Channel);
+			float Diff = HitResultRight.Distance - HitResultLeft.Distance;
+			float Angle = UKismetMathLibrary::Atan(Diff / Probes->EdgeWidth);
 		
-		FVector NewUp = HitResult2.ImpactNormal;
-		FVector NewForward = FVector::CrossProduct(GetActorRightVector(), NewUp);
-		NewForward = NewForward.RotateAngleAxis(-Angle * (180 / PI) * 1, NewUp);
-		FVector NewRight = FVector::CrossProduct(NewUp, NewForward);
-		FRotator NewRotation = UKismetMathLibrary::MakeRotationFromAxes(NewForward, NewRight, NewUp);
-		FVector NewLocation = HitResult2.ImpactPoint +
-			HitResult2.ImpactNormal * ColliderRadius +
-			NewForward * ColliderRadius;
+			FVector NewUp = HitResult2.ImpactNormal;
+			FVector NewForward = FVector::CrossProduct(GetCrawlieRightVector(), NewUp);
+			NewForward = NewForward.RotateAngleAxis(-Angle * (180 / PI) * 1, NewUp);
+			FVector NewRight = FVector::CrossProduct(NewUp, NewForward);
+			FRotator NewRotation = UKismetMathLibrary::MakeRotationFromAxes(NewForward, NewRight, NewUp);
+			FVector NewLocation = HitResult2.ImpactPoint +
+				HitResult2.ImpactNormal * Radius +
+				NewForward * Radius;
 		
 		
-		TargetTransform.SetRotation(NewRotation.Quaternion());
-		TargetTransform.SetLocation(NewLocation);
-		OldTransform.SetRotation(GetActorRotation().Quaternion());
-		OldTransform.SetLocation(GetActorLocation());
-		bIsGoingDown = true;
-		UE_LOG(LogTemp, Warning, TEXT("Going down"));
+			Transition.To.Rotation = FQuat4f(NewRotation.Quaternion());
+			Transition.To.Location = NewLocation;
+			Transition.From = Hot.GetPose();
+			Hot.Set(ECrawlieFlags::GoingDown, true);
+			INC_DWORD_STAT(STAT_CrawlieTransitionsStarted);
+			UE_LOG(LogCrawlie, Warning, TEXT("Going down"));
 
-		return;
+			return;
+		}
 	}
 
+
 	// Trace from below and back/up. Am I on a plane?
 	// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
 	// FString::Printf(TEXT("Still not grounded. Am I on a plane? Checking.")));
 	
-	FVector Start3 = GetActorLocation() +
-					GetActorUpVector() * ColliderRadius * -1.2f;
-	FVector End3 = Start3 +
-					GetActorUpVector() * ColliderRadius +
-					GetActorForwardVector() * ColliderRadius * -1;
-	FHitResult HitResult3;
-	GetWorld()->LineTraceSingleByChannel(HitResult3, Start3, End3, Channel);
-
-	if (HitResult2.bBlockingHit)
 	{
-		// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
-		// 	FString::Printf(TEXT("Found new floor on the flipside")));
-
-		// Get angle of edge data
-		FVector StartRight = Start2 + GetActorRightVector() * 0.2f;
-		FVector EndRight = End2 + GetActorRightVector() * 0.2f;
-		FVector StartLeft = Start2 + GetActorRightVector() * -0.2f;
-		FVector EndLeft = End2 + GetActorRightVector() * -0.2f;
-		FHitResult HitResultRight;
-		FHitResult HitResultLeft;
-		GetWorld()->LineTraceSingleByChannel(HitResultRight, StartRight, EndRight, Channel);
-		GetWorld()->LineTraceSingleByChannel(HitResultLeft, StartLeft, EndLeft, Channel);
-		float Diff = HitResultRight.Distance - HitResultLeft.Distance;
-		float Width = 0.4f;
-		float Angle = UKismetMathLibrary::Atan(Diff / Width);
+		CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTraceFloorFlipside);
+		FHitResult HitResult3;
+		TraceProbe(HitResult3, Probes->Flipside, Frame, Channel);
+
+		if (HitResult3.bBlockingHit)
+		{
+			// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
+			// 	FString::Printf(TEXT("Found new floor on the flipside")));
+
+			// Get angle of edge data
+			FHitResult HitResultRight;
+			FHitResult HitResultLeft;
+			TraceProbe(HitResultRight, Probes->LowerEdge[FCrawlieProbeTable::Right], Frame, Channel);
+			TraceProbe(HitResultLeft, Probes->LowerEdge[FCrawlieProbeTable::Left], Frame, Channel);
+			float Diff = HitResultRight.Distance - HitResultLeft.Distance;
+			float Angle = UKismetMathLibrary::Atan(Diff / Probes->EdgeWidth);
 
 		
-		FVector NewUp = HitResult3.ImpactNormal;
-		FVector NewForward = FVector::CrossProduct(GetActorRightVector(), NewUp);
-		NewForward = NewForward.RotateAngleAxis(-Angle * (180 / PI) * 1, NewUp);
-		FVector NewRight = FVector::CrossProduct(NewUp, NewForward);
-		FRotator Rotator = UKismetMathLibrary::MakeRotationFromAxes(NewForward, NewRight, NewUp);
-		FVector NewLocation = HitResult3.Location +
-			HitResult3.Normal * ColliderRadius +
-			NewForward * ColliderRadius;
+			FVector NewUp = HitResult3.ImpactNormal;
+			FVector NewForward = FVector::CrossProduct(GetCrawlieRightVector(), NewUp);
+			NewForward = NewForward.RotateAngleAxis(-Angle * (180 / PI) * 1, NewUp);
+			FVector NewRight = FVector::CrossProduct(NewUp, NewForward);
+			FRotator Rotator = UKismetMathLibrary::MakeRotationFromAxes(NewForward, NewRight, NewUp);
+			FVector NewLocation = HitResult3.Location +
+				HitResult3.Normal * Radius +
+				NewForward * Radius;
 		
-		TargetTransform.SetRotation(Rotator.Quaternion());
-		TargetTransform.SetLocation(NewLocation);
-		OldTransform.SetRotation(GetActorRotation().Quaternion());
-		OldTransform.SetLocation(GetActorLocation());
-		bIsGoingDown = true;
-		UE_LOG(LogTemp, Warning, TEXT("Going to flipside"));
+			Transition.To.Rotation = FQuat4f(Rotator.Quaternion());
+			Transition.To.Location = NewLocation;
+			Transition.From = Hot.GetPose();
+			Hot.Set(ECrawlieFlags::GoingDown, true);
+			INC_DWORD_STAT(STAT_CrawlieTransitionsStarted);
+			UE_LOG(LogCrawlie, Warning, TEXT("Going to flipside"));
 
-		return;
+			return;
+		}
 	}
 
-	UE_LOG(LogTemp, Warning, TEXT("No floor found"));
+
+	Hot.Set(ECrawlieFlags::WithoutFloor, true);
+	INC_DWORD_STAT(STAT_CrawliesWithoutFloor);
+	UE_LOG(LogCrawlie, Warning, TEXT("No floor found"));
 
 	// GEngine->AddOnScreenDebugMessage(-1, 3.f, FColor::Red,
 	// FString::Printf(TEXT("Still no ground! I guess I'll just keep going..?")));
@@ -418,25 +505,189 @@ void APhyCrawlie::TraceFloor()
 
 
 
-void APhyCrawlie::Move()
+void APhyCrawlie::ClassifyFloor(const FTransform& Frame)
+{
+	CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieTraceFloorClassify);
+	FCrawlieHotState& Hot = GetHot();
+
+	// Straight down under the leading edge. Floor within the usual floor window goes on past the hole
+	// under the center. Floor further down is a step down: land on it as it is.
+	FHitResult HitResult;
+	FVector WrapDirection = GetCrawlieForwardVector();
+	float Overhang = 0;
+	const TCHAR* Transfer = TEXT("Stepping down");
+	if (TraceProbe(HitResult, Probes->FloorAhead, Frame, ECC_WorldStatic))
+	{
+		if (Frame.InverseTransformPositionNoScale(HitResult.ImpactPoint).Z >= -Probes->FloorProbeReach)
+		{
+			UE_LOG(LogCrawlie, Warning, TEXT("Floor seems uneven, but ok"));
+			return;
+		}
+	}
+	// Nothing down to where the classify probe starts, so it starts in the open.
+	else if (!TraceProbe(HitResult, Probes->Classify, Frame, ECC_WorldStatic))
+	{
+		Hot.Set(ECrawlieFlags::WithoutFloor, true);
+		INC_DWORD_STAT(STAT_CrawliesWithoutFloor);
+		UE_LOG(LogCrawlie, Warning, TEXT("No floor found"));
+		return;
+	}
+	else
+	{
+		// A face seen from below is the underside of a plank: turn back along it. Anything else is the
+		// face below the edge we walked off: head down it, square to the edge.
+		const bool bFlipside = Frame.InverseTransformVectorNoScale(HitResult.ImpactNormal).Z < -0.5f;
+		WrapDirection = bFlipside ? -GetCrawlieForwardVector() : -GetCrawlieUpVector();
+		Transfer = bFlipside ? TEXT("Going to flipside") : TEXT("Going down");
+		// Clear of the edge we wrap around.
+		Overhang = Probes->ColliderRadius;
+	}
+
+	const FVector NewUp = HitResult.ImpactNormal;
+	FVector NewForward = FVector::VectorPlaneProject(WrapDirection, NewUp).GetSafeNormal();
+	if (NewForward.IsNearlyZero())
+	{
+		NewForward = FVector::CrossProduct(GetCrawlieRightVector(), NewUp);
+	}
+	FVector NewRight = FVector::CrossProduct(NewUp, NewForward);
+	FRotator NewRotation = UKismetMathLibrary::MakeRotationFromAxes(NewForward, NewRight, NewUp);
+	FVector NewLocation = HitResult.ImpactPoint + NewUp * Probes->ColliderRadius + NewForward * Overhang;
+
+	Transition.To.Rotation = FQuat4f(NewRotation.Quaternion());
+	Transition.To.Location = NewLocation;
+	Transition.From = Hot.GetPose();
+	Hot.Set(ECrawlieFlags::GoingDown, true);
+	INC_DWORD_STAT(STAT_CrawlieTransitionsStarted);
+	UE_LOG(LogCrawlie, Warning, TEXT("%s"), Transfer);
+}
+
+void APhyCrawlie::CommitTransform(float DeltaTime)
+{
+	CRAWLIE_SCOPE_CYCLE_COUNTER(STAT_CrawlieCommitTransform);
+	TimeSinceCommit += DeltaTime;
+	if (OffscreenCommitInterval > 0 &&
+		TimeSinceCommit < OffscreenCommitInterval &&
+		!SkeletalMesh->WasRecentlyRendered(0.2f))
+	{
+		return;
+	}
+
+	TimeSinceCommit = 0;
+	SetActorLocationAndRotation(GetCrawlieLocation(), GetCrawlieQuat());
+}
+
+bool APhyCrawlie::TraceProbe(FHitResult& OutHit, const FCrawlieProbe& Probe, const FTransform& Frame, ECollisionChannel Channel) const
+{
+	FVector Start, End;
+	Probe.ToWorld(Frame, Start, End);
+	return LineTrace(OutHit, Start, End, Channel);
+}
+
+bool APhyCrawlie::LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, ECollisionChannel Channel) const
 {
-	AddActorLocalRotation(FRotator(0,CurrentTurnRateInDegrees, 0) * GetWorld()->GetDeltaSeconds());
-	AddActorLocalOffset(FVector(ForwardSpeed  * GetWorld()->GetDeltaSeconds(), 0, 0));
+	TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(CrawlieLineTrace, CrawlieQueryChannel);
+	if (ReplayPlayer) return ReplayPlayer->NextHit(OutHit);
+
+	INC_DWORD_STAT(STAT_CrawlieRaysCast);
+	GCrawlieRaysCast.fetch_add(1, std::memory_order_relaxed);
+	const bool bHit = GetWorld()->LineTraceSingleByChannel(OutHit, Start, End, Channel);
+	if (Recorder) Recorder->RecordHit(OutHit);
+	return bHit;
 }
 
 void APhyCrawlie::SetNextTimeOfChangeInTurnRate()
 {
-	TimeOfNextTurnRateChange = GetGameTimeSinceCreation() + FMath::RandRange(0.1f, 1.5f);
+	GetHot().TimeUntilTurnRateChange = RandomStream.FRandRange(0.1f, 1.5f);
 }
 
 void APhyCrawlie::UpdateTurnRate()
 {
-	CurrentTurnRateInDegrees = (CurrentTurnRateInDegrees += FMath::RandRange(-15, 15)) % 50;
+	FCrawlieHotState& Hot = GetHot();
+	Hot.TurnRateInDegrees = static_cast<int16>((Hot.TurnRateInDegrees + RandomStream.RandRange(-15, 15)) % 50);
 }
 
 void APhyCrawlie::SetSpeed(int NewSpeed)
 {
-	ForwardSpeed = std::clamp(NewSpeed, 0, 100);
+	GetHot().ForwardSpeed = std::clamp(NewSpeed, 0, 100);
+}
+
+void APhyCrawlie::WriteDormantRecord(FCrawlieDormantRecord& OutRecord) const
+{
+	const FCrawlieHotState& Hot = GetHot();
+	const UPrimitiveComponent* SurfaceComponent = Surface.Get();
+	check(SurfaceComponent);
+
+	// Mid transition, wake up where we were heading rather than in the air.
+	const bool bIsSwitchingSurface = Hot.Has(ECrawlieFlags::GoingUp | ECrawlieFlags::GoingDown);
+	const FVector Location = bIsSwitchingSurface ? Transition.To.GetLocation() : GetCrawlieLocation();
+	const FQuat Rotation = bIsSwitchingSurface ? Transition.To.GetRotation() : GetCrawlieQuat();
+	const FTransform& SurfaceTransform = SurfaceComponent->GetComponentTransform();
+
+	OutRecord.Class = GetClass();
+	OutRecord.Profile = Profile;
+	OutRecord.SurfaceActor = SurfaceComponent->GetOwner()->GetFName();
+	OutRecord.SurfaceComponent = SurfaceComponent->GetFName();
+	OutRecord.LocalLocation = FVector3f(SurfaceTransform.InverseTransformPosition(Location));
+	OutRecord.LocalRotation = FQuat4f(SurfaceTransform.GetRotation().Inverse() * Rotation);
+	OutRecord.RandomSeed = RandomStream.GetCurrentSeed();
+	OutRecord.TimeUntilTurnRateChange = Hot.TimeUntilTurnRateChange;
+	OutRecord.ForwardSpeed = Hot.ForwardSpeed;
+	OutRecord.TurnRateInDegrees = Hot.TurnRateInDegrees;
+}
+
+void APhyCrawlie::RestoreFromDormantRecord(const FCrawlieDormantRecord& Record, UPrimitiveComponent* InSurface)
+{
+	// Called on a deferred spawn, before PostInitializeComponents.
+	AcquireHotState();
+	FCrawlieHotState& Hot = GetHot();
+	Surface = InSurface;
+	Profile = Record.Profile;
+	RandomStream.Initialize(Record.RandomSeed);
+	Hot.TimeUntilTurnRateChange = Record.TimeUntilTurnRateChange;
+	Hot.TurnRateInDegrees = Record.TurnRateInDegrees;
+	Hot.ForwardSpeed = Record.ForwardSpeed;
+	Hot.Set(ECrawlieFlags::Restored, true);
+}
+
+FCrawlieReplayState APhyCrawlie::CaptureReplayState() const
+{
+	FCrawlieReplayState State;
+	State.Hot = GetHot();
+	State.Hot.Set(ECrawlieFlags::Bookkeeping, false);
+	State.Transition = Transition;
+	State.RandomSeed = RandomStream.GetCurrentSeed();
+	return State;
+}
+
+void APhyCrawlie::BeginReplay(FCrawlieReplayPlayer* InPlayer, const FCrawlieReplayState& State)
+{
+	ReplayPlayer = InPlayer;
+	ApplyProfile();
+	GetHot() = State.Hot;
+	Transition = State.Transition;
+	RandomStream.Initialize(State.RandomSeed);
+}
+
+void APhyCrawlie::EndReplay()
+{
+	ReplayPlayer = nullptr;
+}
+
+bool APhyCrawlie::SaveReplay() const
+{
+	return Recorder && Recorder->Save(FCrawlieReplay::GetDefaultPath(*this), Profile);
+}
+
+const UCrawlieProfile& APhyCrawlie::GetProfile() const
+{
+	return Profile ? *Profile : *GetDefault<UCrawlieProfile>();
+}
+
+void APhyCrawlie::ApplyProfile()
+{
+	const UCrawlieProfile& Source = GetProfile();
+	Probes = &Source.GetProbeTable();
+	Root->SetSphereRadius(Source.ColliderRadius);
 }
 
 
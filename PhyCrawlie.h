@@ -3,10 +3,18 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
+#include "CrawlieState.h"
+#include "CrawlieReplay.h"
+#include "CrawlieSwarmSubsystem.h"
 #include "PhyCrawlie.generated.h"
 
 class USphereComponent;
 class USkeletalMeshComponent;
+class UPrimitiveComponent;
+class UCrawlieProfile;
+struct FCrawlieDormantRecord;
+struct FCrawlieProbe;
+struct FCrawlieProbeTable;
 
 UCLASS()
 class PHY_API APhyCrawlie : public AActor
@@ -16,59 +24,87 @@ class PHY_API APhyCrawlie : public AActor
 public:	
 	APhyCrawlie();
 
-	UPROPERTY()
-	float DTime;
 	UPROPERTY()
 	USphereComponent* Root;
 	UPROPERTY(BlueprintReadWrite, EditDefaultsOnly)
 	USkeletalMeshComponent* SkeletalMesh;
-	UPROPERTY()
-	float ColliderRadius = 10;
-	UPROPERTY()
-	float ForwardSpeed = 30;
-	UPROPERTY()
-	float TraceAheadDistance = 25;
-	UPROPERTY()
-	float MaxStepHeight;
+	// Species tuning. Crawlers without one use the class defaults of UCrawlieProfile.
+	UPROPERTY(EditAnywhere)
+	UCrawlieProfile* Profile;
+	// Seconds between transform writes while the mesh is not being rendered. 0 writes every frame.
+	UPROPERTY(EditDefaultsOnly)
+	float OffscreenCommitInterval = 0;
+	// Keep a replay ring of this crawler even when crawlie.Replay.Record is off.
+	UPROPERTY(EditAnywhere)
+	bool bRecordReplay = false;
 
 private:
-	UPROPERTY()
-	int CurrentTurnRateInDegrees = 0;
-	UPROPERTY()
-	float TimeOfNextTurnRateChange = 0;
-	UPROPERTY()
-	bool bIsSwitchingSurface = false;
-	UPROPERTY()
-	bool bIsGoingUp = false;
-	UPROPERTY()
-	bool bIsGoingDown = false;
-	UPROPERTY()
-	int SurfaceSwitchesDone = 0;
-	UPROPERTY()
-	FTransform OldTransform;
-	UPROPERTY()
-	FTransform TargetTransform;
-	UPROPERTY()
-	bool bIsWallAhead = false;
-	UPROPERTY()
-	bool bGapAhead = false;
-	UPROPERTY()
-	FHitResult LastVoidHit;
-	UPROPERTY()
-	float LerpValue = 0;
+	// The hot state is a slot in the swarm's array, so its phases walk crawlers in memory order. Outside
+	// a swarm world (editor previews, or after the swarm is gone) the crawler keeps it here instead.
+	UCrawlieSwarmSubsystem* Swarm = nullptr;
+	int32 HotHandle = INDEX_NONE;
+	TUniquePtr<FCrawlieHotState> DetachedHot;
+	FCrawlieTransition Transition;
+	float TimeSinceCommit = 0;
+	TWeakObjectPtr<UPrimitiveComponent> Surface;
+	FRandomStream RandomStream;
+	TUniquePtr<FCrawlieReplayRecorder> Recorder;
+	FCrawlieReplayPlayer* ReplayPlayer = nullptr;
+	const FCrawlieProbeTable* Probes = nullptr;
 
 protected:
+	virtual void PostInitializeComponents() override;
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void BeginDestroy() override;
 
 public:
 	virtual void Tick(float DeltaTime) override;
-	void GoToNewSurface();
+	// One step of the crawler: Integrate, Sense, Decide, then CommitTransform. The swarm runs each
+	// phase across all of its crawlers before starting the next.
+	void TickCrawler(float DeltaTime);
+	void Integrate(float DeltaTime);
+	// Integrate for a crawler on its surface, which only needs the hot state. The swarm calls it
+	// directly so walking crawlers don't touch their actor.
+	static void IntegrateWalking(FCrawlieHotState& Hot, float DeltaTime);
+	void Sense();
+	void Decide(float DeltaTime);
+	void ChangeTurnRate();
+	void GoToNewSurface(float DeltaTime);
 	void TraceForBarrier();
 	void TraceFloor();
+	void ClassifyFloor(const FTransform& Frame);
 	void TraceAhead();
 	void SetTransforms(FHitResult* HitResultR, FHitResult* HitResultL, float TraceWidth);
 	void SetNextTimeOfChangeInTurnRate();
 	void UpdateTurnRate();
 	void SetSpeed(int NewSpeed);
-	void Move();
+	void CommitTransform(float DeltaTime);
+	bool IsWithoutFloor() const { return GetHot().Has(ECrawlieFlags::WithoutFloor); }
+	// A Blueprint subclass implements Event Tick, which only the actor tick calls.
+	bool HasBlueprintTick() const;
+	UPrimitiveComponent* GetSurface() const { return Surface.Get(); }
+	void WriteDormantRecord(FCrawlieDormantRecord& OutRecord) const;
+	void RestoreFromDormantRecord(const FCrawlieDormantRecord& Record, UPrimitiveComponent* InSurface);
+	FCrawlieReplayState CaptureReplayState() const;
+	void BeginReplay(FCrawlieReplayPlayer* InPlayer, const FCrawlieReplayState& State);
+	void EndReplay();
+	bool SaveReplay() const;
+	const UCrawlieProfile& GetProfile() const;
+
+private:
+	FCrawlieHotState& GetHot() { return Swarm ? Swarm->GetHotState(HotHandle) : *DetachedHot; }
+	const FCrawlieHotState& GetHot() const { return Swarm ? Swarm->GetHotState(HotHandle) : *DetachedHot; }
+	void AcquireHotState();
+	FVector GetCrawlieLocation() const { return GetHot().GetLocation(); }
+	FQuat GetCrawlieQuat() const { return FQuat(GetHot().GetRotation()); }
+	FVector GetCrawlieForwardVector() const { return GetCrawlieQuat().GetForwardVector(); }
+	FVector GetCrawlieRightVector() const { return GetCrawlieQuat().GetRightVector(); }
+	FVector GetCrawlieUpVector() const { return GetCrawlieQuat().GetUpVector(); }
+	FTransform GetCrawlieFrame() const { return FTransform(GetCrawlieQuat(), GetCrawlieLocation()); }
+	void ApplyProfile();
+	bool LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, ECollisionChannel Channel) const;
+	bool TraceProbe(FHitResult& OutHit, const FCrawlieProbe& Probe, const FTransform& Frame, ECollisionChannel Channel) const;
+
+	friend class UCrawlieSwarmSubsystem;
 };